@@ -0,0 +1,142 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+/**
+ * @brief A REST request as seen by the handlers, independent of the server engine
+*/
+struct api_request {
+	std::string method;
+	std::string path;
+	std::string query;
+	std::string body;
+	std::vector<std::pair<std::string, std::string>> headers;
+
+	/**
+	 * @brief Find a header value by case-insensitive name, nullptr if absent
+	*/
+	const std::string* header(const char* name) const {
+		for (const auto& h : headers) {
+			if (h.first.size() == std::char_traits<char>::length(name) && same_name(h.first, name)) {
+				return &h.second;
+			}
+		}
+		return nullptr;
+	}
+
+private:
+	static bool same_name(const std::string& a, const char* b) {
+		for (size_t i = 0; i < a.size(); i++) {
+			char x = a[i], y = b[i];
+			if (x >= 'A' && x <= 'Z') x += 'a' - 'A';
+			if (y >= 'A' && y <= 'Z') y += 'a' - 'A';
+			if (x != y) return false;
+		}
+		return true;
+	}
+};
+
+/**
+ * @brief A feed of serialized server-sent events a response can stay subscribed to.
+ * Events are numbered from 0; every subscriber shares the same serialized frames.
+*/
+class api_event_source
+{
+public:
+	virtual ~api_event_source() {}
+	// The number of the next event to be published.
+	virtual uint64_t head() const = 0;
+	// The frame of event seq, nullptr if it is not published yet;
+	// lost is set if it has already been overwritten.
+	virtual std::shared_ptr<const std::string> get(uint64_t seq, bool& lost) const = 0;
+	// An eventfd written to after every publish, shared by all streams of a server thread.
+	virtual void watch(int fd) = 0;
+	virtual void unwatch(int fd) = 0;
+	// Count of open streams, publishers may skip work without subscribers.
+	virtual void subscribed(int delta) = 0;
+};
+
+/**
+ * @brief A REST response filled in by the handlers
+*/
+struct api_response {
+	int status = 200;
+	std::string content_type = "application/json";
+	std::string body;
+	// Extra headers, Access-Control-Allow-Origin is always added.
+	std::vector<std::pair<std::string, std::string>> headers;
+	// If set, the body is sent as the start of an open ended stream
+	// followed by the events of the source from number stream_from on.
+	api_event_source* stream = nullptr;
+	uint64_t stream_from = 0;
+};
+
+typedef void (*api_handler)(const api_request& msg, api_response& res);
+
+/**
+ * @brief One entry of the route table, matched on exact method and path
+*/
+struct api_route {
+	const char* method;
+	const char* path;
+	api_handler handler;
+};
+
+/**
+ * @brief The reason phrase of the status codes we send
+*/
+inline const char* status_text(int status) {
+	switch (status) {
+	case 200: return "OK";
+	case 204: return "No Content";
+	case 304: return "Not Modified";
+	case 400: return "Bad Request";
+	case 404: return "Not Found";
+	case 405: return "Method Not Allowed";
+	case 408: return "Request Timeout";
+	case 413: return "Payload Too Large";
+	case 500: return "Internal Server Error";
+	case 501: return "Not Implemented";
+	case 503: return "Service Unavailable";
+	default: return "Unknown";
+	}
+}
+
+/**
+ * @brief Quote a string as a JSON string literal
+*/
+inline std::string json_string(const std::string& s) {
+	std::string out = "\"";
+	for (char c : s) {
+		switch (c) {
+		case '"': out += "\\\""; break;
+		case '\\': out += "\\\\"; break;
+		case '\n': out += "\\n"; break;
+		case '\r': out += "\\r"; break;
+		case '\t': out += "\\t"; break;
+		default:
+			if ((unsigned char) c < 0x20) {
+				char buf[8];
+				snprintf(buf, sizeof(buf), "\\u%04x", c);
+				out += buf;
+			} else {
+				out += c;
+			}
+		}
+	}
+	return out + "\"";
+}
+
+/**
+ * @brief Format a double as a JSON number
+*/
+inline std::string json_number(double value) {
+	char buf[32];
+	snprintf(buf, sizeof(buf), "%.6g", value);
+	return buf;
+}
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <time.h>
+
+#include "histogram.hpp"
+
+/**
+ * @brief Deadline-based beat clock.
+ * Beats fire at absolute deadlines on the monotonic clock, each one a
+ * whole period after the previous deadline, so the time spent in the beat
+ * callback and wakeup latency never accumulate into the phase. A period
+ * change takes effect at the next beat boundary.
+*/
+class beat_scheduler
+{
+public:
+	typedef std::chrono::steady_clock clock;
+	// Called on the scheduler thread with the beat number and its deadline.
+	typedef std::function<void(uint64_t beat, clock::time_point deadline)> beat_func;
+
+public:
+	explicit beat_scheduler(beat_func on_beat, std::chrono::microseconds period = std::chrono::seconds(1))
+	: m_on_beat(on_beat), m_period_us(period.count()), m_running(false), m_missed(0) {}
+
+	/**
+	 * @brief Set the beat period, used from the next beat boundary on
+	*/
+	void set_period(std::chrono::microseconds period) {
+		if (period.count() > 0) {
+			m_period_us.store(period.count(), std::memory_order_release);
+		}
+	}
+	std::chrono::microseconds period() const {
+		return std::chrono::microseconds(m_period_us.load(std::memory_order_acquire));
+	}
+
+	/**
+	 * @brief Wakeup lateness of every beat against its deadline, in microseconds
+	*/
+	const histogram& lateness() const { return m_lateness; }
+
+	// Beats skipped because the thread woke up more than a period late.
+	uint64_t missed() const { return m_missed.load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief The scheduler loop, run it on its own thread
+	*/
+	void run() {
+		m_running = true;
+		uint64_t beat = 0;
+		clock::time_point deadline = clock::now() + period();
+		while (m_running.load(std::memory_order_relaxed)) {
+			sleep_until(deadline);
+			clock::time_point woke = clock::now();
+			int64_t late_us = std::chrono::duration_cast<std::chrono::microseconds>(woke - deadline).count();
+			m_lateness.record(late_us > 0 ? (uint64_t) late_us : 0);
+
+			m_on_beat(beat++, deadline);
+
+			// The period is picked up at the boundary, the phase carries over.
+			std::chrono::microseconds p = period();
+			deadline += p;
+			clock::time_point now = clock::now();
+			if (now >= deadline) {
+				// Overran a whole period, skip the lost beats but keep the phase.
+				uint64_t behind = (uint64_t) ((now - deadline) / p) + 1;
+				deadline += p * behind;
+				beat += behind;
+				m_missed.fetch_add(behind, std::memory_order_relaxed);
+			}
+		}
+	}
+
+	void stop() { m_running = false; }
+
+	/**
+	 * @brief Sleep until an absolute time on the monotonic clock
+	*/
+	static void sleep_until(clock::time_point deadline) {
+		// steady_clock is CLOCK_MONOTONIC; sleeping on an absolute time
+		// avoids the drift of computing a relative sleep.
+		auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline.time_since_epoch()).count();
+		struct timespec ts;
+		ts.tv_sec = (time_t) (ns / 1000000000);
+		ts.tv_nsec = (long) (ns % 1000000000);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, nullptr) == EINTR) {}
+	}
+
+private:
+	beat_func m_on_beat;
+	std::atomic<int64_t> m_period_us;
+	std::atomic<bool> m_running;
+	std::atomic<uint64_t> m_missed;
+	histogram m_lateness;
+};
@@ -0,0 +1,345 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+/**
+ * @brief Incremental parser of a batch of BPM values.
+ * The body is either a JSON array or newline delimited JSON (one value per
+ * line). Each element is a number or an object with a "bpm" number, e.g.
+ * [120, {"bpm": 98}] or {"bpm":120}\n{"bpm":98}\n. Bytes are fed in any
+ * pieces as they arrive; only the current element is buffered, so there is
+ * no DOM of the whole body. Elements that are not a whole BPM in range are
+ * counted as rejected, a broken array makes the whole batch invalid.
+*/
+class bpm_batch_parser
+{
+public:
+	// Largest BPM accepted in a batch.
+	enum { max_bpm = 1000 };
+	// Longest single element, anything longer is rejected unparsed.
+	enum { max_element = 256 };
+
+public:
+	bpm_batch_parser()
+	: m_mode(DETECT), m_depth(0), m_in_string(false), m_escape(false),
+	  m_overflow(false), m_broken(false), m_seen_comma(false), m_rejected(0) {}
+
+	/**
+	 * @brief Feed the next piece of the body
+	 * @return false once the body can not be a valid batch
+	*/
+	bool feed(const char* data, size_t size) {
+		for (size_t i = 0; i < size && !m_broken; i++) {
+			step(data[i]);
+		}
+		return !m_broken;
+	}
+
+	/**
+	 * @brief End of the body, flushes the last NDJSON line
+	 * @return false if the batch is invalid and nothing should be applied
+	*/
+	bool finish() {
+		if (m_broken) {
+			return false;
+		}
+		switch (m_mode) {
+		case DETECT:
+			// An empty body is an empty batch.
+			return true;
+		case LINES:
+			if (m_depth != 0 || m_in_string) {
+				// A cut off last line.
+				m_rejected++;
+			} else if (!blank(m_element)) {
+				end_element();
+			}
+			return true;
+		case ARRAY:
+			// The closing bracket was never seen.
+			return false;
+		case DONE:
+			return true;
+		}
+		return false;
+	}
+
+	const std::vector<size_t>& values() const { return m_values; }
+	size_t accepted() const { return m_values.size(); }
+	size_t rejected() const { return m_rejected; }
+
+private:
+	enum mode { DETECT, ARRAY, LINES, DONE };
+
+	static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+
+	void step(char c) {
+		switch (m_mode) {
+		case DETECT:
+			if (is_space(c)) {
+				return;
+			}
+			if (c == '[') {
+				m_mode = ARRAY;
+				return;
+			}
+			m_mode = LINES;
+			element_char(c);
+			return;
+		case DONE:
+			// Only white space may follow the array.
+			if (!is_space(c)) {
+				m_broken = true;
+			}
+			return;
+		case ARRAY:
+			if (m_depth == 0 && !m_in_string && (c == ',' || c == ']')) {
+				if (blank(m_element)) {
+					// Only "[]" may have no element before the delimiter.
+					if (c == ',' || m_seen_comma) {
+						m_broken = true;
+					}
+				} else {
+					end_element();
+				}
+				m_seen_comma = (c == ',');
+				if (c == ']') {
+					m_mode = DONE;
+				}
+				return;
+			}
+			element_char(c);
+			return;
+		case LINES:
+			if (c == '\n' && !m_in_string) {
+				if (m_depth != 0) {
+					// An unbalanced line, drop it and resync on the next one.
+					m_depth = 0;
+					m_element.clear();
+					m_overflow = false;
+					m_rejected++;
+					return;
+				}
+				if (!blank(m_element)) {
+					end_element();
+				}
+				m_element.clear();
+				return;
+			}
+			element_char(c);
+			return;
+		}
+	}
+
+	// Track nesting so the element delimiters are found, and buffer the element.
+	void element_char(char c) {
+		if (m_in_string) {
+			if (m_escape) {
+				m_escape = false;
+			} else if (c == '\\') {
+				m_escape = true;
+			} else if (c == '"') {
+				m_in_string = false;
+			}
+		} else if (c == '"') {
+			m_in_string = true;
+		} else if (c == '{' || c == '[') {
+			m_depth++;
+		} else if (c == '}' || c == ']') {
+			if (m_depth == 0) {
+				if (m_mode == ARRAY) {
+					m_broken = true;
+				}
+				m_overflow = true;
+				return;
+			}
+			m_depth--;
+		}
+		if (m_element.size() < max_element) {
+			m_element += c;
+		} else {
+			m_overflow = true;
+		}
+	}
+
+	void end_element() {
+		size_t bpm = 0;
+		if (!m_overflow && element_value(m_element, bpm)) {
+			m_values.push_back(bpm);
+		} else {
+			m_rejected++;
+		}
+		m_element.clear();
+		m_overflow = false;
+	}
+
+	static bool blank(const std::string& s) {
+		for (char c : s) {
+			if (!is_space(c)) return false;
+		}
+		return true;
+	}
+
+	// A number, or the "bpm" member of an object, as a whole BPM in range.
+	static bool element_value(const std::string& text, size_t& bpm) {
+		size_t pos = 0;
+		skip_space(text, pos);
+		double value;
+		if (pos < text.size() && text[pos] == '{') {
+			if (!object_bpm(text, pos, value)) {
+				return false;
+			}
+		} else if (!number(text, pos, value)) {
+			return false;
+		}
+		skip_space(text, pos);
+		if (pos != text.size()) {
+			return false;
+		}
+		if (!(value >= 1 && value <= max_bpm) || value != std::floor(value)) {
+			return false;
+		}
+		bpm = (size_t) value;
+		return true;
+	}
+
+	static void skip_space(const std::string& s, size_t& pos) {
+		while (pos < s.size() && is_space(s[pos])) pos++;
+	}
+
+	static bool number(const std::string& s, size_t& pos, double& value) {
+		if (pos >= s.size() || !(s[pos] == '-' || (s[pos] >= '0' && s[pos] <= '9'))) {
+			return false;
+		}
+		const char* begin = s.c_str() + pos;
+		char* end = nullptr;
+		value = strtod(begin, &end);
+		if (end == begin) {
+			return false;
+		}
+		pos += (size_t) (end - begin);
+		return true;
+	}
+
+	static bool quoted(const std::string& s, size_t& pos, std::string& out) {
+		if (pos >= s.size() || s[pos] != '"') {
+			return false;
+		}
+		for (pos++; pos < s.size(); pos++) {
+			if (s[pos] == '\\') {
+				if (++pos >= s.size()) return false;
+				out += s[pos];
+			} else if (s[pos] == '"') {
+				pos++;
+				return true;
+			} else {
+				out += s[pos];
+			}
+		}
+		return false;
+	}
+
+	// Skip any JSON value that is not the one we are looking for.
+	static bool skip_value(const std::string& s, size_t& pos) {
+		skip_space(s, pos);
+		if (pos >= s.size()) {
+			return false;
+		}
+		char c = s[pos];
+		if (c == '"') {
+			std::string ignored;
+			return quoted(s, pos, ignored);
+		}
+		if (c == '{' || c == '[') {
+			char close = c == '{' ? '}' : ']';
+			pos++;
+			skip_space(s, pos);
+			if (pos < s.size() && s[pos] == close) {
+				pos++;
+				return true;
+			}
+			while (true) {
+				if (c == '{') {
+					std::string key;
+					skip_space(s, pos);
+					if (!quoted(s, pos, key)) return false;
+					skip_space(s, pos);
+					if (pos >= s.size() || s[pos] != ':') return false;
+					pos++;
+				}
+				if (!skip_value(s, pos)) return false;
+				skip_space(s, pos);
+				if (pos < s.size() && s[pos] == ',') {
+					pos++;
+					continue;
+				}
+				if (pos < s.size() && s[pos] == close) {
+					pos++;
+					return true;
+				}
+				return false;
+			}
+		}
+		static const char* literals[] = { "true", "false", "null" };
+		for (const char* lit : literals) {
+			size_t n = std::char_traits<char>::length(lit);
+			if (s.compare(pos, n, lit) == 0) {
+				pos += n;
+				return true;
+			}
+		}
+		double ignored;
+		return number(s, pos, ignored);
+	}
+
+	static bool object_bpm(const std::string& s, size_t& pos, double& value) {
+		bool found = false;
+		pos++;
+		skip_space(s, pos);
+		if (pos < s.size() && s[pos] == '}') {
+			pos++;
+			return false;
+		}
+		while (true) {
+			std::string key;
+			skip_space(s, pos);
+			if (!quoted(s, pos, key)) return false;
+			skip_space(s, pos);
+			if (pos >= s.size() || s[pos] != ':') return false;
+			pos++;
+			skip_space(s, pos);
+			if (key == "bpm") {
+				if (found || !number(s, pos, value)) return false;
+				found = true;
+			} else if (!skip_value(s, pos)) {
+				return false;
+			}
+			skip_space(s, pos);
+			if (pos < s.size() && s[pos] == ',') {
+				pos++;
+				continue;
+			}
+			if (pos < s.size() && s[pos] == '}') {
+				pos++;
+				return found;
+			}
+			return false;
+		}
+	}
+
+private:
+	mode m_mode;
+	int m_depth;
+	bool m_in_string;
+	bool m_escape;
+	bool m_overflow;
+	bool m_broken;
+	bool m_seen_comma;
+	std::string m_element;
+	std::vector<size_t> m_values;
+	size_t m_rejected;
+};
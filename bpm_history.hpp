@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <vector>
+
+/**
+ * @brief Fixed-capacity history of BPM measurements.
+ * Values live in a ring buffer, the oldest is overwritten when it is full.
+ * An ordered index from value to the sequence numbers holding it gives
+ * O(1) min/max and O(log n) insert and delete-by-value. Deleting leaves a
+ * tombstone in the ring, which is skipped by every query.
+ * Not thread safe, the metronome serializes writers.
+*/
+class bpm_history
+{
+public:
+	explicit bpm_history(size_t capacity)
+	: m_ring(capacity ? capacity : 1), m_filled(0), m_next_seq(0), m_live(0), m_latest_seq(0) {}
+
+	size_t capacity() const { return m_ring.size(); }
+	// The number of live (not deleted) values.
+	size_t size() const { return m_live; }
+	bool empty() const { return m_live == 0; }
+
+	/**
+	 * @brief Append a value, evicting the oldest slot when full
+	*/
+	void add(size_t value) {
+		if (m_filled == m_ring.size()) {
+			uint64_t oldest = m_next_seq - m_filled;
+			slot& old = m_ring[oldest % m_ring.size()];
+			if (old.live) {
+				// The evicted slot is the oldest live occurrence of its value.
+				unindex(old.value, oldest);
+				m_live--;
+			}
+		} else {
+			m_filled++;
+		}
+		uint64_t seq = m_next_seq++;
+		m_ring[seq % m_ring.size()] = slot{ value, true };
+		m_index[value].push_back(seq);
+		m_live++;
+		m_latest_seq = seq;
+	}
+
+	/**
+	 * @brief Delete the oldest live occurrence of a value
+	 * @return false if the value is not in the history
+	*/
+	bool remove(size_t value) {
+		auto it = m_index.find(value);
+		if (it == m_index.end()) {
+			return false;
+		}
+		uint64_t seq = it->second.front();
+		it->second.pop_front();
+		if (it->second.empty()) {
+			m_index.erase(it);
+		}
+		m_ring[seq % m_ring.size()].live = false;
+		m_live--;
+		if (seq == m_latest_seq) {
+			find_latest();
+		}
+		return true;
+	}
+
+	size_t min() const { return m_index.empty() ? 0 : m_index.begin()->first; }
+	size_t max() const { return m_index.empty() ? 0 : m_index.rbegin()->first; }
+
+	/**
+	 * @brief The newest live value, 0 if the history is empty
+	*/
+	size_t latest() const { return m_live == 0 ? 0 : m_ring[m_latest_seq % m_ring.size()].value; }
+
+	/**
+	 * @brief Call f(value) for every live value, oldest first
+	*/
+	template <typename F>
+	void for_each(F f) const {
+		for (uint64_t seq = m_next_seq - m_filled; seq != m_next_seq; seq++) {
+			const slot& s = m_ring[seq % m_ring.size()];
+			if (s.live) {
+				f(s.value);
+			}
+		}
+	}
+
+	std::vector<size_t> values() const {
+		std::vector<size_t> out;
+		out.reserve(m_live);
+		for_each([&out](size_t v) { out.push_back(v); });
+		return out;
+	}
+
+private:
+	struct slot {
+		size_t value;
+		bool live;
+	};
+
+	void unindex(size_t value, uint64_t seq) {
+		auto it = m_index.find(value);
+		if (it != m_index.end() && !it->second.empty() && it->second.front() == seq) {
+			it->second.pop_front();
+			if (it->second.empty()) {
+				m_index.erase(it);
+			}
+		}
+	}
+
+	// Walk back over tombstones to the newest live slot.
+	void find_latest() {
+		uint64_t oldest = m_next_seq - m_filled;
+		uint64_t seq = m_latest_seq;
+		while (seq != oldest && !m_ring[seq % m_ring.size()].live) {
+			seq--;
+		}
+		m_latest_seq = seq;
+	}
+
+private:
+	std::vector<slot> m_ring;
+	size_t m_filled;
+	uint64_t m_next_seq;
+	size_t m_live;
+	uint64_t m_latest_seq;
+	std::map<size_t, std::deque<uint64_t>> m_index;
+};
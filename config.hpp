@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+/**
+ * @brief Startup options of the daemon, from --name=value arguments
+*/
+struct daemon_config {
+	// "epoll" for the built-in server, "cpprest" for the cpprest listeners.
+	std::string engine = "epoll";
+	std::string host = "0.0.0.0";
+	int port = 8080;
+	int workers = 2;
+	// Mutations queued or running at once before new ones get 503.
+	int max_inflight = 256;
+	// Time a request has to arrive and complete, in milliseconds.
+	int timeout_ms = 10000;
+
+	/**
+	 * @brief Parse the command line, return false on an unknown option
+	*/
+	bool parse(int argc, char** argv) {
+		for (int i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			std::string value;
+			if (option(arg, "--engine=", value)) {
+				engine = value;
+			} else if (option(arg, "--host=", value)) {
+				host = value;
+			} else if (option(arg, "--port=", value)) {
+				port = std::atoi(value.c_str());
+			} else if (option(arg, "--workers=", value)) {
+				workers = std::atoi(value.c_str());
+			} else if (option(arg, "--max-inflight=", value)) {
+				max_inflight = std::atoi(value.c_str());
+			} else if (option(arg, "--timeout-ms=", value)) {
+				timeout_ms = std::atoi(value.c_str());
+			} else {
+				std::cerr << "unknown option " << arg << std::endl;
+				usage(argv[0]);
+				return false;
+			}
+		}
+		if (engine != "epoll" && engine != "cpprest") {
+			std::cerr << "unknown engine " << engine << std::endl;
+			return false;
+		}
+		return true;
+	}
+
+	static void usage(const char* name) {
+		std::cerr << "usage: " << name
+			<< " [--engine=epoll|cpprest] [--host=0.0.0.0] [--port=8080] [--workers=2]"
+			<< " [--max-inflight=256] [--timeout-ms=10000]" << std::endl;
+	}
+
+private:
+	static bool option(const std::string& arg, const char* prefix, std::string& value) {
+		std::string p(prefix);
+		if (arg.compare(0, p.size(), p) != 0) {
+			return false;
+		}
+		value = arg.substr(p.size());
+		return true;
+	}
+};
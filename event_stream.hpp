@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "api.hpp"
+
+/**
+ * @brief Fan-out ring of server-sent events.
+ * Each event is serialized once into an SSE frame and stored in a fixed
+ * ring of shared frames; subscribers keep their own cursor into the ring
+ * and share the frames. Publishing never waits on a subscriber: a reader
+ * that falls a whole ring behind finds its next event overwritten and is
+ * dropped by the server. Server threads are woken through their eventfd,
+ * so the cost of a publish does not grow with the number of clients.
+*/
+class event_stream : public api_event_source
+{
+public:
+	enum { capacity = 1024 };
+
+public:
+	event_stream() : m_ring(capacity), m_head(0), m_subscribers(0) {}
+
+	/**
+	 * @brief Serialize and publish one event
+	 * @param type the SSE event name
+	 * @param data the JSON payload, on one line
+	 * @return the event number
+	*/
+	uint64_t publish(const char* type, const std::string& data) {
+		std::lock_guard<std::mutex> lock(m_publish_mutex);
+		uint64_t seq = m_head.load(std::memory_order_relaxed);
+		std::shared_ptr<entry> e(new entry());
+		e->seq = seq;
+		e->frame = "id: " + std::to_string(seq) + "\nevent: " + type + "\ndata: " + data + "\n\n";
+		// The slot is filled before the head moves, readers check the slot seq.
+		std::atomic_store(&m_ring[seq % capacity], std::shared_ptr<const entry>(std::move(e)));
+		m_head.store(seq + 1, std::memory_order_release);
+		uint64_t one = 1;
+		for (int fd : m_watchers) {
+			if (write(fd, &one, sizeof(one)) < 0) {}
+		}
+		return seq;
+	}
+
+	// True if someone is listening, publishers skip building events otherwise.
+	bool has_subscribers() const { return m_subscribers.load(std::memory_order_relaxed) > 0; }
+
+	uint64_t head() const override { return m_head.load(std::memory_order_acquire); }
+
+	std::shared_ptr<const std::string> get(uint64_t seq, bool& lost) const override {
+		lost = false;
+		if (seq >= head()) {
+			return nullptr;
+		}
+		std::shared_ptr<const entry> e = std::atomic_load(&m_ring[seq % capacity]);
+		if (!e || e->seq != seq) {
+			lost = true;
+			return nullptr;
+		}
+		return std::shared_ptr<const std::string>(e, &e->frame);
+	}
+
+	void watch(int fd) override {
+		std::lock_guard<std::mutex> lock(m_publish_mutex);
+		m_watchers.push_back(fd);
+	}
+
+	void unwatch(int fd) override {
+		std::lock_guard<std::mutex> lock(m_publish_mutex);
+		m_watchers.erase(std::remove(m_watchers.begin(), m_watchers.end(), fd), m_watchers.end());
+	}
+
+	void subscribed(int delta) override { m_subscribers.fetch_add(delta, std::memory_order_relaxed); }
+
+private:
+	struct entry {
+		uint64_t seq;
+		std::string frame;
+	};
+
+private:
+	std::vector<std::shared_ptr<const entry>> m_ring;
+	std::atomic<uint64_t> m_head;
+	std::atomic<int> m_subscribers;
+	// Serializes publishers and the watcher list, subscribers never take it.
+	std::mutex m_publish_mutex;
+	std::vector<int> m_watchers;
+};
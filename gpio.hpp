@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+
+// Pin levels, modes and pulls, matching the pigpio values.
+#define GPIO_LOW    0
+#define GPIO_HIGH   1
+#define GPIO_INPUT  0
+#define GPIO_OUTPUT 1
+#define GPIO_PUD_OFF  0
+#define GPIO_PUD_DOWN 1
+#define GPIO_PUD_UP   2
+
+/**
+ * @brief The GPIO hardware abstraction used by the daemon.
+ * Timestamps are microseconds on the backend's monotonic clock.
+*/
+class gpio_backend
+{
+public:
+	// Called on a backend thread for every edge of a watched input pin.
+	typedef void (*alert_func)(int pin, int level, uint64_t time_us, void* userdata);
+
+public:
+	virtual ~gpio_backend() {}
+
+	virtual bool initialise() = 0;
+	virtual void terminate() = 0;
+
+	virtual void set_mode(int pin, int mode) = 0;
+	virtual void set_pull(int pin, int pud) = 0;
+	virtual int read(int pin) = 0;
+	virtual void write(int pin, int level) = 0;
+
+	/**
+	 * @brief Register the edge callback of an input pin, nullptr to remove it
+	*/
+	virtual bool set_alert(int pin, alert_func func, void* userdata) = 0;
+
+	/**
+	 * @brief The current time on the same clock as the alert timestamps
+	*/
+	virtual uint64_t now_us() = 0;
+
+	virtual const char* name() const = 0;
+};
+
+// The backend is picked at build time with the METRONOME_GPIO_BACKEND cmake option.
+#ifdef METRONOME_GPIO_SIM
+#include "gpio_sim.hpp"
+inline gpio_backend& gpio() {
+	static sim_gpio backend;
+	return backend;
+}
+#else
+#include "gpio_pigpio.hpp"
+inline gpio_backend& gpio() {
+	static pigpio_gpio backend;
+	return backend;
+}
+#endif
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstdint>
+#include <mutex>
+#include <pigpio.h>
+
+#include "gpio.hpp"
+
+/**
+ * @brief GPIO backend on the real pigpio library
+*/
+class pigpio_gpio : public gpio_backend
+{
+public:
+	enum { max_pins = 54 };
+
+public:
+	pigpio_gpio() : m_tick_high(0), m_last_tick(0) {
+		for (int i = 0; i < max_pins; i++) {
+			m_alerts[i].owner = this;
+			m_alerts[i].func = nullptr;
+			m_alerts[i].userdata = nullptr;
+		}
+	}
+
+	bool initialise() override { return gpioInitialise() >= 0; }
+	void terminate() override { gpioTerminate(); }
+
+	void set_mode(int pin, int mode) override { gpioSetMode(pin, mode); }
+	void set_pull(int pin, int pud) override { gpioSetPullUpDown(pin, pud); }
+	int read(int pin) override { return gpioRead(pin); }
+	void write(int pin, int level) override { gpioWrite(pin, level); }
+
+	bool set_alert(int pin, alert_func func, void* userdata) override {
+		if (pin < 0 || pin >= max_pins) {
+			return false;
+		}
+		m_alerts[pin].func = func;
+		m_alerts[pin].userdata = userdata;
+		return gpioSetAlertFuncEx(pin, func ? on_alert : nullptr, func ? &m_alerts[pin] : nullptr) == 0;
+	}
+
+	uint64_t now_us() override { return extend_tick(gpioTick()); }
+
+	const char* name() const override { return "pigpio"; }
+
+private:
+	struct alert {
+		pigpio_gpio* owner;
+		alert_func func;
+		void* userdata;
+	};
+
+	// Extend the 32-bit pigpio tick, which wraps every ~72 minutes.
+	// Alerts and now_us() run on different threads, so ticks may arrive
+	// slightly out of order; only a jump of over half the range is a wrap.
+	uint64_t extend_tick(uint32_t tick) {
+		std::lock_guard<std::mutex> lock(m_tick_mutex);
+		uint32_t diff = tick - m_last_tick;
+		if (diff < 0x80000000u) {
+			// Newer than the last tick, possibly across the wrap.
+			if (tick < m_last_tick) {
+				m_tick_high += (uint64_t(1) << 32);
+			}
+			m_last_tick = tick;
+			return m_tick_high | tick;
+		}
+		// Older than the last tick, possibly from before the wrap.
+		if (tick > m_last_tick && m_tick_high != 0) {
+			return (m_tick_high - (uint64_t(1) << 32)) | tick;
+		}
+		return m_tick_high | tick;
+	}
+
+	static void on_alert(int gpio, int level, uint32_t tick, void* userdata) {
+		alert* a = static_cast<alert*>(userdata);
+		if (level == PI_TIMEOUT || a->func == nullptr) {
+			return;
+		}
+		a->func(gpio, level, a->owner->extend_tick(tick), a->userdata);
+	}
+
+private:
+	alert m_alerts[max_pins];
+	std::mutex m_tick_mutex;
+	uint64_t m_tick_high;
+	uint32_t m_last_tick;
+};
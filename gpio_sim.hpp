@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "gpio.hpp"
+
+/**
+ * @brief In-process GPIO simulator.
+ * Input edges are played from a script at their scripted times, and every
+ * output write is recorded with its timestamp, so tap-to-LED latency can be
+ * measured without a Pi. The script is read from $METRONOME_SIM_SCRIPT,
+ * one edge per line: "<time_us> <pin> <level>", '#' starts a comment.
+ * When the script has been played, report() is printed to stdout.
+*/
+class sim_gpio : public gpio_backend
+{
+public:
+	enum { max_pins = 54 };
+
+	struct edge {
+		uint64_t time_us;
+		int pin;
+		int level;
+	};
+
+public:
+	sim_gpio() : m_running(false), m_start(std::chrono::steady_clock::now()) {
+		for (int i = 0; i < max_pins; i++) {
+			m_levels[i] = GPIO_LOW;
+			m_modes[i] = GPIO_INPUT;
+			m_alerts[i].func = nullptr;
+			m_alerts[i].userdata = nullptr;
+		}
+	}
+	~sim_gpio() { terminate(); }
+
+	bool initialise() override {
+		if (m_running) {
+			return true;
+		}
+		m_start = std::chrono::steady_clock::now();
+		const char* path = std::getenv("METRONOME_SIM_SCRIPT");
+		if (path != nullptr && !load_script(path)) {
+			std::cerr << "sim: cannot read script " << path << std::endl;
+			return false;
+		}
+		m_running = true;
+		m_player = std::thread(&sim_gpio::play, this);
+		return true;
+	}
+
+	void terminate() override {
+		if (!m_running.exchange(false)) {
+			return;
+		}
+		m_cond.notify_all();
+		if (m_player.joinable()) {
+			m_player.join();
+		}
+	}
+
+	void set_mode(int pin, int mode) override {
+		if (valid(pin)) m_modes[pin] = mode;
+	}
+
+	void set_pull(int pin, int pud) override {
+		if (!valid(pin)) return;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (pud == GPIO_PUD_UP) m_levels[pin] = GPIO_HIGH;
+		else if (pud == GPIO_PUD_DOWN) m_levels[pin] = GPIO_LOW;
+	}
+
+	int read(int pin) override {
+		if (!valid(pin)) return GPIO_LOW;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_levels[pin];
+	}
+
+	void write(int pin, int level) override {
+		if (!valid(pin)) return;
+		uint64_t now = now_us();
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (m_levels[pin] != level) {
+			m_outputs.push_back(edge{ now, pin, level });
+		}
+		m_levels[pin] = level;
+	}
+
+	bool set_alert(int pin, alert_func func, void* userdata) override {
+		if (!valid(pin)) return false;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_alerts[pin].func = func;
+		m_alerts[pin].userdata = userdata;
+		return true;
+	}
+
+	uint64_t now_us() override {
+		return std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::steady_clock::now() - m_start).count();
+	}
+
+	const char* name() const override { return "sim"; }
+
+public:
+	/**
+	 * @brief Load the input edges of a script file
+	*/
+	bool load_script(const std::string& path) {
+		std::ifstream in(path);
+		if (!in) {
+			return false;
+		}
+		std::string line;
+		while (std::getline(in, line)) {
+			line = line.substr(0, line.find('#'));
+			std::istringstream fields(line);
+			edge e;
+			if (fields >> e.time_us >> e.pin >> e.level) {
+				schedule_edge(e.pin, e.level, e.time_us);
+			}
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Schedule an input edge at a time relative to initialise()
+	*/
+	void schedule_edge(int pin, int level, uint64_t at_us) {
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			edge e{ at_us, pin, level };
+			auto pos = std::upper_bound(m_script.begin(), m_script.end(), e,
+				[](const edge& a, const edge& b) { return a.time_us < b.time_us; });
+			m_script.insert(pos, e);
+		}
+		m_cond.notify_all();
+	}
+
+	/**
+	 * @brief The input edges played so far and the recorded output transitions
+	*/
+	std::vector<edge> inputs() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_inputs;
+	}
+	std::vector<edge> outputs() {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		return m_outputs;
+	}
+
+	/**
+	 * @brief Print the recorded transitions and the input-to-output latencies.
+	 * Each output rising edge is matched to the latest unmatched press before it.
+	*/
+	void report(std::ostream& out) {
+		std::vector<edge> ins = inputs();
+		std::vector<edge> outs = outputs();
+		for (const edge& e : outs) {
+			out << "sim: out " << e.time_us << " pin " << e.pin << " level " << e.level << "\n";
+		}
+		std::vector<uint64_t> latencies;
+		size_t i = 0;
+		for (const edge& o : outs) {
+			if (o.level != GPIO_HIGH) continue;
+			// The latest press not yet matched, so earlier bounces are skipped.
+			bool found = false;
+			uint64_t pressed_at = 0;
+			for (; i < ins.size() && ins[i].time_us <= o.time_us; i++) {
+				if (ins[i].level == GPIO_LOW) {
+					found = true;
+					pressed_at = ins[i].time_us;
+				}
+			}
+			if (found) {
+				latencies.push_back(o.time_us - pressed_at);
+			}
+		}
+		if (!latencies.empty()) {
+			std::sort(latencies.begin(), latencies.end());
+			out << "sim: press-to-led latency us min " << latencies.front()
+				<< " p50 " << latencies[latencies.size() / 2]
+				<< " max " << latencies.back()
+				<< " n " << latencies.size() << "\n";
+		}
+		out.flush();
+	}
+
+private:
+	bool valid(int pin) const { return pin >= 0 && pin < max_pins; }
+
+	// Play the script on its own thread, firing alerts like pigpio does.
+	void play() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		bool played = false;
+		while (m_running) {
+			if (m_script.empty()) {
+				if (played) {
+					// Let the output pipeline settle before reporting.
+					played = false;
+					if (m_cond.wait_for(lock, std::chrono::seconds(2)) == std::cv_status::timeout) {
+						lock.unlock();
+						report(std::cout);
+						lock.lock();
+					}
+				} else {
+					m_cond.wait(lock);
+				}
+				continue;
+			}
+			edge e = m_script.front();
+			auto at = m_start + std::chrono::microseconds(e.time_us);
+			if (std::chrono::steady_clock::now() < at) {
+				// Woken early by a new edge or terminate(), re-check.
+				m_cond.wait_until(lock, at);
+				continue;
+			}
+			m_script.pop_front();
+			played = true;
+			if (!valid(e.pin) || m_levels[e.pin] == e.level) continue;
+			m_levels[e.pin] = e.level;
+			e.time_us = now_us();
+			m_inputs.push_back(e);
+			alert a = m_alerts[e.pin];
+			if (a.func != nullptr) {
+				lock.unlock();
+				a.func(e.pin, e.level, e.time_us, a.userdata);
+				lock.lock();
+			}
+		}
+	}
+
+private:
+	struct alert {
+		alert_func func;
+		void* userdata;
+	};
+
+	std::atomic<bool> m_running;
+	std::chrono::steady_clock::time_point m_start;
+	std::thread m_player;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	int m_levels[max_pins];
+	int m_modes[max_pins];
+	alert m_alerts[max_pins];
+	std::deque<edge> m_script;
+	std::vector<edge> m_inputs;
+	std::vector<edge> m_outputs;
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+/**
+ * @brief Log-linear histogram of non-negative integer samples (HDR style).
+ * Values below 8 get their own bucket, above that every power of two is
+ * split in 8 sub-buckets, so the relative error stays under 12.5%.
+ * record() is a few relaxed atomic adds and is safe from any thread.
+*/
+class histogram
+{
+public:
+	enum { sub_buckets = 8, buckets = 8 * 62 };
+
+public:
+	histogram() { reset(); }
+
+	void record(uint64_t value) {
+		m_counts[index_of(value)].fetch_add(1, std::memory_order_relaxed);
+		m_count.fetch_add(1, std::memory_order_relaxed);
+		m_sum.fetch_add(value, std::memory_order_relaxed);
+		uint64_t max = m_max.load(std::memory_order_relaxed);
+		while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {}
+	}
+
+	void reset() {
+		for (int i = 0; i < buckets; i++) {
+			m_counts[i].store(0, std::memory_order_relaxed);
+		}
+		m_count.store(0, std::memory_order_relaxed);
+		m_sum.store(0, std::memory_order_relaxed);
+		m_max.store(0, std::memory_order_relaxed);
+	}
+
+	uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+	uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+	uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+	double mean() const {
+		uint64_t n = count();
+		return n == 0 ? 0.0 : (double) sum() / (double) n;
+	}
+
+	/**
+	 * @brief The upper bound of the bucket holding the p-th percentile
+	 * @param p the percentile, 0 to 100
+	*/
+	uint64_t percentile(double p) const {
+		uint64_t n = count();
+		if (n == 0) {
+			return 0;
+		}
+		uint64_t rank = (uint64_t) ((p / 100.0) * (double) n + 0.5);
+		if (rank == 0) rank = 1;
+		uint64_t seen = 0;
+		for (int i = 0; i < buckets; i++) {
+			seen += m_counts[i].load(std::memory_order_relaxed);
+			if (seen >= rank) {
+				uint64_t upper = upper_bound_of(i);
+				uint64_t m = max();
+				return upper < m ? upper : m;
+			}
+		}
+		return max();
+	}
+
+	/**
+	 * @brief The non-empty buckets as (inclusive upper bound, count) pairs
+	*/
+	std::vector<std::pair<uint64_t, uint64_t>> buckets_used() const {
+		std::vector<std::pair<uint64_t, uint64_t>> out;
+		for (int i = 0; i < buckets; i++) {
+			uint64_t c = m_counts[i].load(std::memory_order_relaxed);
+			if (c != 0) {
+				out.push_back(std::make_pair(upper_bound_of(i), c));
+			}
+		}
+		return out;
+	}
+
+	static int index_of(uint64_t value) {
+		if (value < sub_buckets) {
+			return (int) value;
+		}
+		int exp = 63 - __builtin_clzll(value);
+		int sub = (int) ((value >> (exp - 3)) & (sub_buckets - 1));
+		int index = (exp - 2) * sub_buckets + sub;
+		return index < buckets ? index : buckets - 1;
+	}
+
+	static uint64_t lower_bound_of(int index) {
+		if (index < sub_buckets) {
+			return (uint64_t) index;
+		}
+		int exp = index / sub_buckets + 2;
+		uint64_t sub = (uint64_t) (index % sub_buckets);
+		return (sub_buckets + sub) << (exp - 3);
+	}
+
+	static uint64_t upper_bound_of(int index) {
+		return index + 1 < buckets ? lower_bound_of(index + 1) - 1 : UINT64_MAX;
+	}
+
+private:
+	std::atomic<uint64_t> m_counts[buckets];
+	std::atomic<uint64_t> m_count;
+	std::atomic<uint64_t> m_sum;
+	std::atomic<uint64_t> m_max;
+};
@@ -0,0 +1,825 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "api.hpp"
+#include "request_stats.hpp"
+
+/**
+ * @brief Small HTTP/1.1 server on one listening socket and epoll.
+ * Every worker thread runs its own epoll loop over the shared listening
+ * socket (EPOLLEXCLUSIVE, so only one worker wakes per connection) and
+ * keeps the connections it accepted. Requests are dispatched through a
+ * static route table, keep-alive and pipelining are supported.
+ * GETs are answered inline. Mutations are queued to a small executor pool
+ * and their response is handed back to the worker, so a slow handler never
+ * stalls the event loop; when max_in_flight mutations are queued, new ones
+ * get 503 with Retry-After.
+ * A response with an event source turns its connection into a server-sent
+ * event stream: the worker appends the source's shared frames as they are
+ * published and drops the client when it falls too far behind.
+*/
+class http_server
+{
+public:
+	struct config {
+		std::string host = "0.0.0.0";
+		int port = 8080;
+		int workers = 2;
+		int executors = 2;
+		int max_in_flight = 256;
+		// A request must arrive and be handled within this time.
+		int request_timeout_ms = 10000;
+		// Keep-alive connections with no request are closed after this time.
+		int idle_timeout_ms = 60000;
+		size_t max_header = 16 * 1024;
+		size_t max_body = 1024 * 1024;
+		// Unsent event bytes after which a slow stream client is dropped.
+		size_t max_stream_backlog = 256 * 1024;
+		// A comment line is sent on quiet streams so dead peers are noticed.
+		int stream_heartbeat_ms = 15000;
+	};
+
+	typedef std::chrono::steady_clock clock;
+
+public:
+	template <size_t N>
+	http_server(const api_route (&routes)[N], const config& cfg, request_stats* stats = nullptr)
+	: m_routes(routes), m_route_count(N), m_config(cfg), m_stats(stats), m_gate(cfg.max_in_flight),
+	  m_listen_fd(-1), m_stop_fd(-1), m_running(false) {}
+	~http_server() { stop(); }
+
+	/**
+	 * @brief Bind the listening socket and start the workers
+	*/
+	bool start() {
+		m_listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if (m_listen_fd < 0) {
+			std::cerr << "http: socket: " << strerror(errno) << std::endl;
+			return false;
+		}
+		int one = 1;
+		setsockopt(m_listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons((uint16_t) m_config.port);
+		if (inet_pton(AF_INET, m_config.host.c_str(), &addr.sin_addr) != 1) {
+			std::cerr << "http: bad bind address " << m_config.host << std::endl;
+			return false;
+		}
+		if (bind(m_listen_fd, (sockaddr*) &addr, sizeof(addr)) < 0 || listen(m_listen_fd, SOMAXCONN) < 0) {
+			std::cerr << "http: bind " << m_config.host << ":" << m_config.port << ": " << strerror(errno) << std::endl;
+			return false;
+		}
+		m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		m_running = true;
+		int executors = m_config.executors > 0 ? m_config.executors : 1;
+		for (int i = 0; i < executors; i++) {
+			m_executors.emplace_back(&http_server::executor_loop, this);
+		}
+		int workers = m_config.workers > 0 ? m_config.workers : 1;
+		for (int i = 0; i < workers; i++) {
+			std::unique_ptr<worker> w(new worker());
+			w->thread = std::thread(&http_server::worker_loop, this, w.get());
+			m_workers.push_back(std::move(w));
+		}
+		return true;
+	}
+
+	void stop() {
+		if (!m_running.exchange(false)) {
+			return;
+		}
+		uint64_t one = 1;
+		if (write(m_stop_fd, &one, sizeof(one)) < 0) {}
+		m_jobs_cond.notify_all();
+		for (auto& t : m_executors) {
+			t.join();
+		}
+		for (auto& w : m_workers) {
+			w->thread.join();
+		}
+		m_executors.clear();
+		m_workers.clear();
+		close(m_listen_fd);
+		close(m_stop_fd);
+	}
+
+	/**
+	 * @brief Run one request through the route table
+	*/
+	void dispatch(const api_request& req, api_response& res) const {
+		bool path_found = false;
+		for (size_t i = 0; i < m_route_count; i++) {
+			const api_route& r = m_routes[i];
+			if (req.path != r.path) {
+				continue;
+			}
+			path_found = true;
+			if (req.method == r.method) {
+				try {
+					r.handler(req, res);
+				} catch (const std::exception& e) {
+					res = api_response();
+					res.status = 500;
+					res.body = "{\"msg\":\"Internal Server Error\"}";
+				}
+				return;
+			}
+		}
+		if (path_found && req.method == "OPTIONS") {
+			// Same CORS preflight answer as rest::allowAll.
+			res.status = 200;
+			res.body.clear();
+			res.headers.push_back(std::make_pair("Access-Control-Allow-Methods", "GET, PUT, DELETE"));
+			res.headers.push_back(std::make_pair("Access-Control-Allow-Headers", "Content-Type"));
+			return;
+		}
+		res.status = path_found ? 405 : 404;
+		res.body = path_found ? "{\"msg\":\"Method Not Allowed\"}" : "{\"msg\":\"Not Found\"}";
+	}
+
+private:
+	// epoll user data of the non-connection descriptors
+	enum { LISTEN_ID = 0, STOP_ID = 1, DONE_ID = 2, STREAM_ID = 3, FIRST_CONN_ID = 16 };
+
+	struct connection {
+		int fd;
+		std::string in;
+		std::string out;
+		size_t out_pos = 0;
+		bool busy = false;        // a mutation is on the executor
+		bool close_after = false; // close once the output is written
+		bool peer_closed = false;
+		bool want_write = false;
+		clock::time_point request_start;
+		clock::time_point last_active;
+		// Event stream state, the frames are shared with every other stream.
+		api_event_source* stream = nullptr;
+		uint64_t cursor = 0;
+		std::deque<std::shared_ptr<const std::string>> frames;
+		size_t frame_pos = 0;
+		size_t backlog = 0;
+	};
+
+	struct completion {
+		uint64_t conn_id;
+		size_t route;
+		bool keep_alive;
+		clock::time_point arrived;
+		api_response res;
+	};
+
+	struct worker {
+		int ep = -1;
+		int done_fd = -1;
+		int stream_fd = -1;
+		std::thread thread;
+		std::mutex done_mutex;
+		std::vector<completion> done;
+		std::unordered_map<uint64_t, std::unique_ptr<connection>> conns;
+		uint64_t next_id = FIRST_CONN_ID;
+		std::vector<uint64_t> streams;
+		std::vector<api_event_source*> sources;
+	};
+
+	struct job {
+		worker* owner;
+		uint64_t conn_id;
+		size_t route;
+		bool keep_alive;
+		clock::time_point arrived;
+		api_request req;
+	};
+
+	enum parse_result { NEED_MORE, PARSED, BAD };
+
+	void worker_loop(worker* w) {
+		w->ep = epoll_create1(EPOLL_CLOEXEC);
+		w->done_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		w->stream_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		epoll_event ev;
+		ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+		ev.data.u64 = LISTEN_ID;
+		epoll_ctl(w->ep, EPOLL_CTL_ADD, m_listen_fd, &ev);
+		ev.events = EPOLLIN;
+		ev.data.u64 = STOP_ID;
+		epoll_ctl(w->ep, EPOLL_CTL_ADD, m_stop_fd, &ev);
+		ev.events = EPOLLIN;
+		ev.data.u64 = DONE_ID;
+		epoll_ctl(w->ep, EPOLL_CTL_ADD, w->done_fd, &ev);
+		ev.events = EPOLLIN;
+		ev.data.u64 = STREAM_ID;
+		epoll_ctl(w->ep, EPOLL_CTL_ADD, w->stream_fd, &ev);
+
+		epoll_event events[64];
+		clock::time_point last_sweep = clock::now();
+		while (m_running) {
+			int n = epoll_wait(w->ep, events, 64, 250);
+			if (n < 0 && errno != EINTR) {
+				break;
+			}
+			for (int i = 0; i < n; i++) {
+				uint64_t id = events[i].data.u64;
+				if (id == STOP_ID) {
+					continue;
+				}
+				if (id == LISTEN_ID) {
+					accept_all(w);
+					continue;
+				}
+				if (id == DONE_ID) {
+					on_completions(w);
+					continue;
+				}
+				if (id == STREAM_ID) {
+					on_stream_events(w);
+					continue;
+				}
+				auto it = w->conns.find(id);
+				if (it == w->conns.end()) {
+					continue;
+				}
+				connection* c = it->second.get();
+				bool alive = !(events[i].events & EPOLLERR);
+				if (alive && (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP))) {
+					alive = on_readable(w, id, c);
+				}
+				if (alive && (events[i].events & EPOLLOUT)) {
+					alive = flush(c);
+				}
+				settle(w, id, c, alive);
+			}
+			clock::time_point now = clock::now();
+			if (now - last_sweep >= std::chrono::milliseconds(250)) {
+				sweep_timeouts(w, now);
+				last_sweep = now;
+			}
+		}
+		for (auto& c : w->conns) {
+			if (c.second->stream) {
+				c.second->stream->subscribed(-1);
+			}
+			close(c.second->fd);
+		}
+		w->conns.clear();
+		for (api_event_source* source : w->sources) {
+			source->unwatch(w->stream_fd);
+		}
+		close(w->stream_fd);
+		close(w->done_fd);
+		close(w->ep);
+	}
+
+	void accept_all(worker* w) {
+		while (true) {
+			int fd = accept4(m_listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+			if (fd < 0) {
+				return;
+			}
+			int one = 1;
+			setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+			std::unique_ptr<connection> c(new connection());
+			c->fd = fd;
+			c->last_active = clock::now();
+			uint64_t id = w->next_id++;
+			epoll_event ev;
+			ev.events = EPOLLIN | EPOLLRDHUP;
+			ev.data.u64 = id;
+			epoll_ctl(w->ep, EPOLL_CTL_ADD, fd, &ev);
+			w->conns[id] = std::move(c);
+		}
+	}
+
+	// Close the connection when it failed or is done, else fix its epoll interest.
+	void settle(worker* w, uint64_t id, connection* c, bool alive) {
+		bool want_write = c->out_pos < c->out.size() || !c->frames.empty();
+		bool drained = !want_write && !c->busy;
+		if (!alive || (drained && (c->close_after || c->peer_closed)) || (c->stream && c->peer_closed)) {
+			if (c->stream) {
+				c->stream->subscribed(-1);
+				w->streams.erase(std::find(w->streams.begin(), w->streams.end(), id));
+			}
+			epoll_ctl(w->ep, EPOLL_CTL_DEL, c->fd, nullptr);
+			close(c->fd);
+			w->conns.erase(id);
+			return;
+		}
+		if (want_write != c->want_write) {
+			epoll_event ev;
+			// Stop reading a half-closed peer, the hangup would fire forever.
+			ev.events = (c->peer_closed ? 0 : (EPOLLIN | EPOLLRDHUP)) | (want_write ? EPOLLOUT : 0);
+			ev.data.u64 = id;
+			epoll_ctl(w->ep, EPOLL_CTL_MOD, c->fd, &ev);
+			c->want_write = want_write;
+		}
+	}
+
+	// Read what is available and answer the complete requests.
+	bool on_readable(worker* w, uint64_t id, connection* c) {
+		char buf[16384];
+		while (!c->peer_closed) {
+			ssize_t n = read(c->fd, buf, sizeof(buf));
+			if (n > 0) {
+				if (c->in.empty()) {
+					c->request_start = clock::now();
+				}
+				c->in.append(buf, (size_t) n);
+				continue;
+			}
+			if (n == 0) {
+				// Peer closed its side; still answer what it sent.
+				c->peer_closed = true;
+				epoll_event ev;
+				ev.events = 0;
+				ev.data.u64 = id;
+				epoll_ctl(w->ep, EPOLL_CTL_MOD, c->fd, &ev);
+				c->want_write = false;
+				break;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				break;
+			}
+			if (errno != EINTR) {
+				return false;
+			}
+		}
+		c->last_active = clock::now();
+		process_input(w, id, c);
+		return flush(c);
+	}
+
+	// Parse and answer requests until one goes to the executor or input runs out.
+	void process_input(worker* w, uint64_t id, connection* c) {
+		while (!c->busy && !c->close_after && !c->stream && !c->in.empty()) {
+			api_request req;
+			bool keep_alive = true;
+			size_t consumed = 0;
+			int error_status = 400;
+			parse_result r = parse(c->in, req, keep_alive, consumed, error_status);
+			if (r == NEED_MORE) {
+				break;
+			}
+			api_response res;
+			if (r == BAD) {
+				res.status = error_status;
+				res.body = "{\"msg\":\"" + std::string(status_text(error_status)) + "\"}";
+				serialize(res, false, c->out);
+				c->close_after = true;
+				c->in.clear();
+				break;
+			}
+			c->in.erase(0, consumed);
+			if (!c->in.empty()) {
+				c->request_start = clock::now();
+			}
+			clock::time_point arrived = clock::now();
+			size_t route = m_stats ? m_stats->find(req.method, req.path) : m_route_count;
+			if (is_mutation(req.method) && find_route(req) != nullptr) {
+				if (!m_gate.try_acquire()) {
+					busy_reply(res);
+					if (m_stats) m_stats->rejected();
+				} else {
+					// Hand the mutation to the executors; the reply comes back as a completion.
+					c->busy = true;
+					{
+						std::lock_guard<std::mutex> lock(m_jobs_mutex);
+						m_jobs.push_back(job{ w, id, route, keep_alive, arrived, std::move(req) });
+					}
+					m_jobs_cond.notify_one();
+					return;
+				}
+			} else {
+				dispatch(req, res);
+			}
+			if (m_stats) {
+				m_stats->record(route, elapsed_us(arrived));
+			}
+			if (res.stream != nullptr) {
+				start_stream(w, id, c, res);
+				return;
+			}
+			serialize(res, keep_alive, c->out);
+			if (!keep_alive) {
+				c->close_after = true;
+			}
+		}
+		if (c->close_after) {
+			c->in.clear();
+		}
+	}
+
+	void executor_loop() {
+		while (true) {
+			job j;
+			{
+				std::unique_lock<std::mutex> lock(m_jobs_mutex);
+				m_jobs_cond.wait(lock, [this] { return !m_jobs.empty() || !m_running; });
+				if (!m_running) {
+					return;
+				}
+				j = std::move(m_jobs.front());
+				m_jobs.pop_front();
+			}
+			completion done;
+			done.conn_id = j.conn_id;
+			done.route = j.route;
+			done.keep_alive = j.keep_alive;
+			done.arrived = j.arrived;
+			if (clock::now() - j.arrived > std::chrono::milliseconds(m_config.request_timeout_ms)) {
+				// Waited too long for a slot, the client has likely given up.
+				done.res.status = 503;
+				done.res.body = "{\"msg\":\"Service Unavailable, request timed out in queue\"}";
+				done.res.headers.push_back(std::make_pair("Retry-After", "1"));
+				if (m_stats) m_stats->timed_out();
+			} else {
+				dispatch(j.req, done.res);
+			}
+			{
+				std::lock_guard<std::mutex> lock(j.owner->done_mutex);
+				j.owner->done.push_back(std::move(done));
+			}
+			m_gate.release();
+			uint64_t one = 1;
+			if (write(j.owner->done_fd, &one, sizeof(one)) < 0) {}
+		}
+	}
+
+	// Write back the executor results and resume the paused connections.
+	void on_completions(worker* w) {
+		uint64_t count;
+		if (read(w->done_fd, &count, sizeof(count)) < 0) {}
+		std::vector<completion> done;
+		{
+			std::lock_guard<std::mutex> lock(w->done_mutex);
+			done.swap(w->done);
+		}
+		for (completion& d : done) {
+			if (m_stats) {
+				m_stats->record(d.route, elapsed_us(d.arrived));
+			}
+			auto it = w->conns.find(d.conn_id);
+			if (it == w->conns.end()) {
+				continue;
+			}
+			connection* c = it->second.get();
+			c->busy = false;
+			serialize(d.res, d.keep_alive, c->out);
+			if (!d.keep_alive) {
+				c->close_after = true;
+			}
+			process_input(w, d.conn_id, c);
+			settle(w, d.conn_id, c, flush(c));
+		}
+	}
+
+	// Answer 408 to requests that stall and close idle keep-alive connections.
+	void sweep_timeouts(worker* w, clock::time_point now) {
+		std::vector<uint64_t> ids;
+		for (auto& entry : w->conns) {
+			ids.push_back(entry.first);
+		}
+		for (uint64_t id : ids) {
+			connection* c = w->conns[id].get();
+			if (c->stream) {
+				if (now - c->last_active > std::chrono::milliseconds(m_config.stream_heartbeat_ms)) {
+					static const std::shared_ptr<const std::string> heartbeat(new std::string(": keep-alive\n\n"));
+					c->frames.push_back(heartbeat);
+					c->backlog += heartbeat->size();
+					c->last_active = now;
+					settle(w, id, c, flush(c));
+				}
+				continue;
+			}
+			if (c->busy || c->close_after) {
+				continue;
+			}
+			if (!c->in.empty() && now - c->request_start > std::chrono::milliseconds(m_config.request_timeout_ms)) {
+				api_response res;
+				res.status = 408;
+				res.body = "{\"msg\":\"Request Timeout\"}";
+				serialize(res, false, c->out);
+				c->close_after = true;
+				c->in.clear();
+				if (m_stats) m_stats->timed_out();
+				settle(w, id, c, flush(c));
+			} else if (c->in.empty() && c->out_pos >= c->out.size()
+				&& now - c->last_active > std::chrono::milliseconds(m_config.idle_timeout_ms)) {
+				settle(w, id, c, false);
+			}
+		}
+	}
+
+	// Write as much of the output as the socket takes, then the queued event frames.
+	bool flush(connection* c) {
+		while (c->out_pos < c->out.size()) {
+			ssize_t n = send(c->fd, c->out.data() + c->out_pos, c->out.size() - c->out_pos, MSG_NOSIGNAL);
+			if (n > 0) {
+				c->out_pos += (size_t) n;
+				continue;
+			}
+			if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+				return true;
+			}
+			if (n < 0 && errno == EINTR) {
+				continue;
+			}
+			return false;
+		}
+		c->out.clear();
+		c->out_pos = 0;
+		while (!c->frames.empty()) {
+			// The shared frames go out as they are, without copying them per client.
+			iovec iov[16];
+			int count = 0;
+			for (auto it = c->frames.begin(); it != c->frames.end() && count < 16; ++it, ++count) {
+				size_t skip = count == 0 ? c->frame_pos : 0;
+				iov[count].iov_base = const_cast<char*>((*it)->data() + skip);
+				iov[count].iov_len = (*it)->size() - skip;
+			}
+			msghdr msg;
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = iov;
+			msg.msg_iovlen = count;
+			ssize_t n = sendmsg(c->fd, &msg, MSG_NOSIGNAL);
+			if (n < 0) {
+				if (errno == EAGAIN || errno == EWOULDBLOCK) {
+					return true;
+				}
+				if (errno == EINTR) {
+					continue;
+				}
+				return false;
+			}
+			size_t sent = (size_t) n;
+			c->backlog -= sent;
+			while (sent > 0) {
+				size_t left = c->frames.front()->size() - c->frame_pos;
+				if (sent < left) {
+					c->frame_pos += sent;
+					break;
+				}
+				sent -= left;
+				c->frames.pop_front();
+				c->frame_pos = 0;
+			}
+		}
+		return true;
+	}
+
+	// Send the stream head and subscribe the connection to its event source.
+	void start_stream(worker* w, uint64_t id, connection* c, const api_response& res) {
+		serialize(res, true, c->out);
+		c->in.clear();
+		c->stream = res.stream;
+		c->cursor = res.stream_from;
+		c->last_active = clock::now();
+		c->stream->subscribed(1);
+		w->streams.push_back(id);
+		if (std::find(w->sources.begin(), w->sources.end(), c->stream) == w->sources.end()) {
+			c->stream->watch(w->stream_fd);
+			w->sources.push_back(c->stream);
+		}
+		pump(c);
+	}
+
+	// Queue the events published since the cursor, false if the client fell behind.
+	bool pump(connection* c) {
+		uint64_t head = c->stream->head();
+		while (c->cursor < head) {
+			bool lost = false;
+			std::shared_ptr<const std::string> frame = c->stream->get(c->cursor, lost);
+			if (lost || !frame) {
+				return false;
+			}
+			c->backlog += frame->size();
+			c->frames.push_back(std::move(frame));
+			c->cursor++;
+			if (c->backlog > m_config.max_stream_backlog) {
+				return false;
+			}
+		}
+		c->last_active = clock::now();
+		return true;
+	}
+
+	// New events were published, pass them on to every stream of this worker.
+	void on_stream_events(worker* w) {
+		uint64_t count;
+		if (read(w->stream_fd, &count, sizeof(count)) < 0) {}
+		std::vector<uint64_t> ids(w->streams);
+		for (uint64_t id : ids) {
+			connection* c = w->conns[id].get();
+			bool alive = pump(c);
+			settle(w, id, c, alive && flush(c));
+		}
+	}
+
+	const api_route* find_route(const api_request& req) const {
+		for (size_t i = 0; i < m_route_count; i++) {
+			if (req.path == m_routes[i].path && req.method == m_routes[i].method) {
+				return &m_routes[i];
+			}
+		}
+		return nullptr;
+	}
+
+	static uint64_t elapsed_us(clock::time_point since) {
+		return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - since).count();
+	}
+
+	parse_result parse(const std::string& in, api_request& req, bool& keep_alive, size_t& consumed, int& error_status) const {
+		size_t header_end = in.find("\r\n\r\n");
+		if (header_end == std::string::npos) {
+			if (in.size() > m_config.max_header) {
+				error_status = 400;
+				return BAD;
+			}
+			return NEED_MORE;
+		}
+		// Request line: METHOD SP target SP version
+		size_t line_end = in.find("\r\n");
+		size_t sp1 = in.find(' ');
+		size_t sp2 = sp1 == std::string::npos ? sp1 : in.find(' ', sp1 + 1);
+		if (sp1 == std::string::npos || sp2 == std::string::npos || sp2 > line_end) {
+			return BAD;
+		}
+		req.method = in.substr(0, sp1);
+		std::string target = in.substr(sp1 + 1, sp2 - sp1 - 1);
+		std::string version = in.substr(sp2 + 1, line_end - sp2 - 1);
+		size_t q = target.find('?');
+		req.path = target.substr(0, q);
+		if (q != std::string::npos) {
+			req.query = target.substr(q + 1);
+		}
+		keep_alive = (version == "HTTP/1.1");
+
+		size_t content_length = 0;
+		size_t pos = line_end + 2;
+		while (pos < header_end) {
+			size_t eol = in.find("\r\n", pos);
+			size_t colon = in.find(':', pos);
+			if (colon == std::string::npos || colon > eol) {
+				return BAD;
+			}
+			std::string name = in.substr(pos, colon - pos);
+			size_t v = colon + 1;
+			while (v < eol && (in[v] == ' ' || in[v] == '\t')) v++;
+			size_t vend = eol;
+			while (vend > v && (in[vend - 1] == ' ' || in[vend - 1] == '\t')) vend--;
+			req.headers.push_back(std::make_pair(name, in.substr(v, vend - v)));
+			pos = eol + 2;
+		}
+		if (const std::string* cl = req.header("Content-Length")) {
+			char* end = nullptr;
+			unsigned long long len = strtoull(cl->c_str(), &end, 10);
+			if (end == cl->c_str() || *end != '\0') {
+				return BAD;
+			}
+			if (len > m_config.max_body) {
+				error_status = 413;
+				return BAD;
+			}
+			content_length = (size_t) len;
+		}
+		if (const std::string* conn = req.header("Connection")) {
+			if (*conn == "close" || *conn == "Close") keep_alive = false;
+			if (*conn == "keep-alive" || *conn == "Keep-Alive") keep_alive = true;
+		}
+		size_t body_start = header_end + 4;
+		if (const std::string* te = req.header("Transfer-Encoding")) {
+			if (te->find("chunked") == std::string::npos) {
+				error_status = 400;
+				return BAD;
+			}
+			return parse_chunked(in, body_start, req.body, consumed, error_status);
+		}
+		if (in.size() - body_start < content_length) {
+			return NEED_MORE;
+		}
+		req.body = in.substr(body_start, content_length);
+		consumed = body_start + content_length;
+		return PARSED;
+	}
+
+	// Decode a chunked body, trailers are read and dropped.
+	parse_result parse_chunked(const std::string& in, size_t pos, std::string& body, size_t& consumed, int& error_status) const {
+		body.clear();
+		while (true) {
+			size_t eol = in.find("\r\n", pos);
+			if (eol == std::string::npos) {
+				return in.size() - pos > 32 ? BAD : NEED_MORE;
+			}
+			char* end = nullptr;
+			unsigned long long len = strtoull(in.c_str() + pos, &end, 16);
+			if (end == in.c_str() + pos || (*end != '\r' && *end != ';')) {
+				return BAD;
+			}
+			if (len > m_config.max_body - body.size()) {
+				error_status = 413;
+				return BAD;
+			}
+			pos = eol + 2;
+			if (len == 0) {
+				break;
+			}
+			if (in.size() - pos < len + 2) {
+				return NEED_MORE;
+			}
+			if (in.compare(pos + len, 2, "\r\n") != 0) {
+				return BAD;
+			}
+			body.append(in, pos, len);
+			pos += len + 2;
+		}
+		// Trailer lines up to the empty line.
+		while (true) {
+			size_t eol = in.find("\r\n", pos);
+			if (eol == std::string::npos) {
+				return in.size() - pos > m_config.max_header ? BAD : NEED_MORE;
+			}
+			bool last = (eol == pos);
+			pos = eol + 2;
+			if (last) {
+				break;
+			}
+		}
+		consumed = pos;
+		return PARSED;
+	}
+
+	static void serialize(const api_response& res, bool keep_alive, std::string& out) {
+		out += "HTTP/1.1 ";
+		out += std::to_string(res.status);
+		out += ' ';
+		out += status_text(res.status);
+		out += "\r\nAccess-Control-Allow-Origin: *\r\n";
+		bool has_body = res.status != 304 && res.status != 204;
+		if (res.stream != nullptr) {
+			// Open ended, the stream lasts until either side closes.
+			out += "Content-Type: ";
+			out += res.content_type;
+			out += "\r\nCache-Control: no-cache\r\n";
+		} else if (has_body) {
+			out += "Content-Type: ";
+			out += res.content_type;
+			out += "\r\nContent-Length: ";
+			out += std::to_string(res.body.size());
+			out += "\r\n";
+		}
+		for (const auto& h : res.headers) {
+			out += h.first;
+			out += ": ";
+			out += h.second;
+			out += "\r\n";
+		}
+		if (!keep_alive) {
+			out += "Connection: close\r\n";
+		}
+		out += "\r\n";
+		if (has_body) {
+			out += res.body;
+		}
+	}
+
+private:
+	const api_route* m_routes;
+	size_t m_route_count;
+	config m_config;
+	request_stats* m_stats;
+	request_gate m_gate;
+	int m_listen_fd;
+	int m_stop_fd;
+	std::atomic<bool> m_running;
+	std::vector<std::unique_ptr<worker>> m_workers;
+	std::vector<std::thread> m_executors;
+	std::mutex m_jobs_mutex;
+	std::condition_variable m_jobs_cond;
+	std::deque<job> m_jobs;
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <cstdint>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "gpio.hpp"
+
+/**
+ * @brief Debounce state machine for one active-low (pull-up) button.
+ * Edges are fed in with their microsecond timestamps, and the first edge of
+ * a press is reported so the timestamp is not delayed by the settle window.
+*/
+class debouncer
+{
+public:
+	enum state {
+		IDLE,             // released and stable
+		PRESS_SETTLING,   // press reported, ignoring contact bounce
+		HELD,             // pressed and stable
+		RELEASE_SETTLING  // released, ignoring contact bounce
+	};
+
+public:
+	explicit debouncer(uint32_t window_us = 20000)
+	: m_state(IDLE), m_window_us(window_us), m_last_change(0) {}
+
+	/**
+	 * @brief Feed one edge of the raw pin level
+	 * @param level the new pin level, GPIO_LOW means pressed
+	 * @param time_us the edge timestamp in microseconds
+	 * @return true if this edge is the start of a new press
+	*/
+	bool on_edge(int level, uint64_t time_us) {
+		bool pressed_level = (level == GPIO_LOW);
+		// Settling states time out lazily on the next edge.
+		if ((m_state == PRESS_SETTLING || m_state == RELEASE_SETTLING)
+			&& time_us - m_last_change >= m_window_us) {
+			m_state = (m_state == PRESS_SETTLING) ? HELD : IDLE;
+		}
+		switch (m_state) {
+		case IDLE:
+			if (pressed_level) {
+				m_state = PRESS_SETTLING;
+				m_last_change = time_us;
+				return true;
+			}
+			return false;
+		case HELD:
+			if (!pressed_level) {
+				m_state = RELEASE_SETTLING;
+				m_last_change = time_us;
+			} else {
+				// The release was swallowed as a bounce, so this is a new press.
+				m_last_change = time_us;
+				m_state = PRESS_SETTLING;
+				return true;
+			}
+			return false;
+		default:
+			// Bounce inside the settle window.
+			return false;
+		}
+	}
+
+	state get_state() const { return m_state; }
+
+private:
+	state m_state;
+	uint64_t m_window_us;
+	uint64_t m_last_change;
+};
+
+/**
+ * @brief Edge-driven button input built on GPIO backend alerts.
+ * The backend calls back on its own thread with the timestamp of each edge,
+ * the edges are debounced per pin and presses are queued for the main thread.
+*/
+class button_input
+{
+public:
+	struct event {
+		int pin;
+		uint64_t time_us; // time of the press edge, in microseconds
+	};
+
+public:
+	explicit button_input(gpio_backend& backend) : m_backend(backend) {}
+	~button_input() {
+		for (auto& p : m_pins) {
+			m_backend.set_alert(p->pin, nullptr, nullptr);
+		}
+	}
+
+	/**
+	 * @brief Start watching a button pin
+	 * @param pin the Broadcom pin number
+	 * @param debounce_us the settle window of the button in microseconds
+	*/
+	bool watch(int pin, uint32_t debounce_us) {
+		std::unique_ptr<pin_state> state(new pin_state(this, pin, debounce_us));
+		if (!m_backend.set_alert(pin, on_alert, state.get())) {
+			return false;
+		}
+		m_pins.push_back(std::move(state));
+		return true;
+	}
+
+	/**
+	 * @brief Block until the next debounced press
+	*/
+	event wait_event() {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [this] { return !m_events.empty(); });
+		event ev = m_events.front();
+		m_events.pop_front();
+		return ev;
+	}
+
+private:
+	struct pin_state {
+		pin_state(button_input* owner, int pin, uint32_t debounce_us)
+		: owner(owner), pin(pin), debounce(debounce_us) {}
+		button_input* owner;
+		int pin;
+		debouncer debounce;
+	};
+
+	static void on_alert(int pin, int level, uint64_t time_us, void* userdata) {
+		pin_state* state = static_cast<pin_state*>(userdata);
+		button_input* self = state->owner;
+		if (state->debounce.on_edge(level, time_us)) {
+			{
+				std::lock_guard<std::mutex> lock(self->m_mutex);
+				self->m_events.push_back(event{ pin, time_us });
+			}
+			self->m_cond.notify_one();
+		}
+	}
+
+private:
+	gpio_backend& m_backend;
+	std::vector<std::unique_ptr<pin_state>> m_pins;
+	std::mutex m_mutex;
+	std::condition_variable m_cond;
+	std::deque<event> m_events;
+};
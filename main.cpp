@@ -1,14 +1,26 @@
 #include <chrono>
+#include <atomic>
+#include <memory>
 #include <thread>
 #include <string>
+#include <vector>
 using namespace std::chrono_literals;
 #include <cpprest/json.h>
 #include <cpprest/http_msg.h>
 // #include <wiringPi.h>
-#include <pigpio.h>
 
 #include "metronome.hpp"
 #include "rest.hpp"
+#include "gpio.hpp"
+#include "input.hpp"
+#include "beat_scheduler.hpp"
+#include "response_cache.hpp"
+#include "api.hpp"
+#include "http_server.hpp"
+#include "request_stats.hpp"
+#include "bpm_batch.hpp"
+#include "event_stream.hpp"
+#include "config.hpp"
 #include "main.h"
 
 // ** Remember to update these numbers to your personal setup. **
@@ -17,269 +29,489 @@ using namespace std::chrono_literals;
 #define BTN_MODE  23
 #define BTN_TAP   24
 
+// Contact bounce settle window of the buttons, in microseconds.
+#define BTN_DEBOUNCE_US 20000
+
+// How many BPM measurements the history keeps before dropping the oldest.
+#define BPM_HISTORY_SIZE 4096
+
 #define MIN 0
 #define MAX 1
 
-// Mark as volatile to enable thread safety.
-volatile bool btn_mode_pressed = false;
-volatile bool is_startup = true; // The startup state of the LED false for on, ture for off.
-size_t blink_gap_time; // The blink gap time of the LED, the default value is 1000ms.
-metronome metro; // The metronome object.
-std::vector<size_t> bpm_list; // The list of BPMs.
-
-// Run an additional loop separate from the main one.
-void blink() {
-	bool on = false;
-	
-	// ** This loop manages LED blinking. **
-	while (true) {
-		// The LED state will toggle once every second.
-		// when the bpm is 120, the LED will blink at the frequency of 500ms, so the blink_gap_time is 500.
-		std::this_thread::sleep_for(std::chrono::milliseconds(blink_gap_time));
-		// Perform the blink if we are pressed,
-		// otherwise just set it to off.
-		if (!metro.is_timing() && !is_startup){
-			// If the metronome is not running, the LED will blink.
-			gpioWrite(LED_GREEN,PI_HIGH);
-			std::this_thread::sleep_for(std::chrono::milliseconds(10));
-			gpioWrite(LED_GREEN,PI_LOW);
-		}
+// Shared by the REST handlers, the button loop and the blink thread.
+std::atomic<bool> is_startup(true); // The startup state of the LED false for on, ture for off.
+metronome metro(BPM_HISTORY_SIZE); // The metronome object, readers never block on it.
+// Serialized GET responses, rebuilt when the metronome state version changes.
+response_cache bpm_cache, bpm_list_cache, min_cache, max_cache;
+// Beat, tempo and tap events pushed to the /bpm/stream subscribers.
+event_stream events;
+
+/**
+ * @brief Convert a steady clock time to unix microseconds for the event stream
+*/
+uint64_t wall_us(std::chrono::steady_clock::time_point t) {
+	auto now = std::chrono::system_clock::now();
+	auto wall = now - std::chrono::duration_cast<std::chrono::system_clock::duration>(std::chrono::steady_clock::now() - t);
+	return (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(wall.time_since_epoch()).count();
+}
+
+// The beat clock, defined below since it calls blink().
+extern beat_scheduler beats;
+
+// Called by the beat scheduler at every beat deadline.
+void blink(uint64_t beat, beat_scheduler::clock::time_point deadline) {
+	if (events.has_subscribers()) {
+		// Serialized once here, every subscriber gets the same frame.
+		events.publish("beat", "{\"beat\":" + std::to_string(beat)
+			+ ",\"time_us\":" + std::to_string(wall_us(deadline))
+			+ ",\"period_us\":" + std::to_string(beats.period().count())
+			+ ",\"playing\":" + (!metro.is_timing() && !is_startup ? "true" : "false") + "}");
+	}
+	// Perform the blink if we are pressed,
+	// otherwise just set it to off.
+	if (!metro.is_timing() && !is_startup){
+		// If the metronome is not running, the LED will blink.
+		gpio().write(LED_GREEN,GPIO_HIGH);
+		// The pulse end is also absolute, so it never delays the next beat.
+		beat_scheduler::sleep_until(deadline + std::chrono::milliseconds(10));
+		gpio().write(LED_GREEN,GPIO_LOW);
 	}
 }
 
+// The beat clock, the default period is 1000ms.
+// when the bpm is 120, the LED will blink at the period of 500ms.
+beat_scheduler beats(blink);
+
 // Check the tap button if it is pressed
 static void blink_led_when_tap () {
-	gpioWrite(LED_RED,PI_HIGH);
+	gpio().write(LED_RED,GPIO_HIGH);
 	std::this_thread::sleep_for(std::chrono::milliseconds(10));
-	gpioWrite(LED_RED,PI_LOW);
+	gpio().write(LED_RED,GPIO_LOW);
 }
 
 /**
- * @brief Override the msg.reply to add the Access-Control-Allow-Origin header and the content type
- * @param msg the http request
+ * @brief Fill in the reply with the content type and the json body
+ * @param res the http response
  * @param content the content to be sent
  * @param mode 1 to send the json witg number(BPM), 0 to send response
 */
-void msg_reply(web::http::http_request msg, size_t content, int mode) {
-	web::http::http_response response(web::http::status_codes::OK);
-	response.headers().set_content_type(U("application/json"));
-    response.headers().add(U("Access-Control-Allow-Origin"), U("*"));
-	web::json::value jsonResponse;
+void msg_reply(api_response& res, size_t content, int mode) {
+	res.status = 200;
 	if(mode == 1){
-    	jsonResponse[U("bpm")] = web::json::value::number(content);
-		response.set_body(jsonResponse);
+		res.body = "{\"bpm\":" + std::to_string(content) + "}";
 	} else {
-    	jsonResponse[U("msg")] = web::json::value::string("your request has been processed successfully!");
-		response.set_body(jsonResponse);
+		res.body = "{\"msg\":\"your request has been processed successfully!\"}";
 	}
-	msg.reply(response);
 }
 
 /**
- * @brief Override the msg.reply to send the error reply message
- * @param msg the http request
+ * @brief Fill in the error reply message
+ * @param res the http response
  * @param content the content to be sent
  * @param status_code the http status code to be sent
 */
-void msg_wrong_reply(web::http::http_request msg, std::string content, web::http::status_code status_code){
-	web::http::http_response response(status_code);
-	response.headers().set_content_type(U("application/json"));
-	response.headers().add(U("Access-Control-Allow-Origin"), U("*"));
-	web::json::value jsonResponse;
-	jsonResponse[U("msg")] = web::json::value::string(content);
-	response.set_body(jsonResponse);
-	msg.reply(response);
+void msg_wrong_reply(api_response& res, std::string content, int status_code){
+	res.status = status_code;
+	res.body = "{\"msg\":" + json_string(content) + "}";
 }
 
 /**
  * @brief Helper function to send the reply when deleting the BPM
  * @param isSuccess true if the BPM is deleted successfully
- * @param msg the http request
+ * @param res the http response
 */
-void deleteBPMUtil(bool isSuccess, web::http::http_request msg){
+void deleteBPMUtil(bool isSuccess, api_response& res){
 	if (isSuccess == false){
-		msg_wrong_reply(msg, "Bad Request, please check the bpm value", web::http::status_codes::BadRequest);
+		msg_wrong_reply(res, "Bad Request, please check the bpm value", 400);
 	}else {
-		msg_reply(msg, 0, 0);
+		msg_reply(res, 0, 0);
 	}
 }
 
+/**
+ * @brief Read the "bpm" integer of a json request body, throws if it is missing
+*/
+int parse_bpm(const api_request& msg) {
+	web::json::value req_body = web::json::value::parse(msg.body);
+	return req_body.at(U("bpm")).as_integer();
+}
+
+/**
+ * @brief Push the BPM state to the event stream when it has changed
+*/
+void publish_tempo() {
+	static std::atomic<uint64_t> published(0);
+	metronome::state s = metro.get_state();
+	uint64_t last = published.load();
+	if (s.version <= last || !published.compare_exchange_strong(last, s.version) || !events.has_subscribers()) {
+		return;
+	}
+	events.publish("tempo", "{\"bpm\":" + std::to_string(s.bpm)
+		+ ",\"min\":" + std::to_string(s.min)
+		+ ",\"max\":" + std::to_string(s.max)
+		+ ",\"size\":" + std::to_string(s.size)
+		+ ",\"version\":" + std::to_string(s.version) + "}");
+}
+
+/**
+ * @brief Push a learn mode change or tap to the event stream
+ * @param time_us the backend microsecond time of the button press
+*/
+void publish_tap(const char* type, uint64_t time_us) {
+	if (!events.has_subscribers()) {
+		return;
+	}
+	metronome::live_tempo live = metro.get_live();
+	uint64_t ago_us = gpio().now_us() - time_us;
+	events.publish(type, "{\"taps\":" + std::to_string(live.taps)
+		+ ",\"bpm\":" + json_number(live.bpm)
+		+ ",\"confidence\":" + json_number(live.confidence)
+		+ ",\"learning\":" + (live.timing ? "true" : "false")
+		+ ",\"time_us\":" + std::to_string(wall_us(std::chrono::steady_clock::now() - std::chrono::microseconds(ago_us))) + "}");
+}
+
 /**
  * @brief Update the blink frequency
 */
 void updateBPM() {
 	size_t curr_bpm = metro.get_bpm();
 	if(curr_bpm != 0){
-		// The frequency of the LED blinking is 60 seconds divided by the BPM.
-		blink_gap_time = (60*1000) / curr_bpm;
+		// The period of the LED blinking is 60 seconds divided by the BPM,
+		// it takes effect at the next beat.
+		beats.set_period(std::chrono::microseconds((60*1000*1000) / curr_bpm));
 		// The LED will blink at the frequency of the BPM.
 		is_startup = false;
 	} else{
 		is_startup = true;	
 	}
+	publish_tempo();
 }
 
 /**
- * @brief The REST service to get the BPM
+ * @brief Reply 304 if the client already has the current version
+ * @param msg the http request
+ * @param version the current state version
+ * @return true if the reply has been filled in
 */
-void getBPM(web::http::http_request msg) {
-	try{
-		msg_reply(msg, metro.get_bpm(), 1);
-	}catch(const std::exception& e){
-		// msg.reply(500, U("Internal Server Error"));
-		msg_wrong_reply(msg, "Internal Server Error", web::http::status_codes::InternalError);
+bool not_modified_reply(const api_request& msg, api_response& res, uint64_t version) {
+	const std::string* header = msg.header("If-None-Match");
+	if (header == nullptr) {
+		return false;
 	}
+	std::string etag = response_cache::etag_of(version);
+	if (!response_cache::matches(*header, etag)) {
+		return false;
+	}
+	res.status = 304;
+	res.headers.push_back(std::make_pair("ETag", etag));
+	return true;
+}
+
+/**
+ * @brief Send a cached response body with its ETag
+*/
+void cached_reply(api_response& res, const response_cache::entry& cached) {
+	res.status = 200;
+	res.body = cached.body;
+	res.headers.push_back(std::make_pair("ETag", cached.etag));
+	res.headers.push_back(std::make_pair("Cache-Control", "no-cache"));
+}
+
+/**
+ * @brief Serve a {"bpm": N} GET from its cache
+ * @param cache the endpoint cache
+ * @param pick selects the number from the metronome state
+*/
+template <typename F>
+void cached_number_reply(const api_request& msg, api_response& res, response_cache& cache, F pick) {
+	uint64_t version = metro.version();
+	if (not_modified_reply(msg, res, version)) {
+		return;
+	}
+	auto cached = cache.get(version, [&pick]() {
+		metronome::state s = metro.get_state();
+		return std::make_pair(s.version, "{\"bpm\":" + std::to_string(pick(s)) + "}");
+	});
+	cached_reply(res, *cached);
+}
+
+/**
+ * @brief The REST service to get the BPM
+*/
+void getBPM(const api_request& msg, api_response& res) {
+	cached_number_reply(msg, res, bpm_cache, [](const metronome::state& s) { return s.bpm; });
 }
 
 /**
  * @brief The REST service to get the BPM list
 */
-void getBPMlist(web::http::http_request msg) {
-	bpm_list = metro.get_bpm_list();
-	try{
-		web::http::http_response response(web::http::status_codes::OK);
-		response.headers().set_content_type(U("application/json"));
-   		response.headers().add(U("Access-Control-Allow-Origin"), U("*"));
-		web::json::value jsonResponse;
-		web::json::value json_bpm_list = web::json::value::array();
-        if (!bpm_list.empty()) {
-            for (size_t i = 0; i < bpm_list.size(); ++i) {
-            	json_bpm_list[i] = web::json::value::number(bpm_list[i]);
-        	}
-        }
-        jsonResponse[U("bpm_list")] = json_bpm_list;
-		response.set_body(jsonResponse);
-		msg.reply(response);
-	}catch(const std::exception& e){
-		// msg.reply(500, U("Internal Server Error"));
-		msg_wrong_reply(msg, "Internal Server Error", web::http::status_codes::InternalError);
+void getBPMlist(const api_request& msg, api_response& res) {
+	uint64_t version = metro.version();
+	if (not_modified_reply(msg, res, version)) {
+		return;
 	}
+	auto cached = bpm_list_cache.get(version, []() {
+		uint64_t list_version;
+		std::vector<size_t> bpm_list = metro.get_bpm_list(&list_version);
+		std::string body = "{\"bpm_list\":[";
+		for (size_t i = 0; i < bpm_list.size(); ++i) {
+			if (i != 0) {
+				body += ',';
+			}
+			body += std::to_string(bpm_list[i]);
+		}
+		body += "]}";
+		return std::make_pair(list_version, body);
+	});
+	cached_reply(res, *cached);
 }
 
 // The REST service to get the MIN and MAX BPM
-void getMIN(web::http::http_request msg) {
-	msg_reply(msg, metro.getMinOrMax(MIN), 1);
+void getMIN(const api_request& msg, api_response& res) {
+	cached_number_reply(msg, res, min_cache, [](const metronome::state& s) { return s.min; });
+}
+void getMAX(const api_request& msg, api_response& res) {
+	cached_number_reply(msg, res, max_cache, [](const metronome::state& s) { return s.max; });
+}
+
+/**
+ * @brief The REST service to get the live tempo estimate, updated on every tap in learn mode
+*/
+void getLive(const api_request& msg, api_response& res) {
+	metronome::live_tempo live = metro.get_live();
+	res.body = "{\"bpm\":" + json_number(live.bpm)
+		+ ",\"confidence\":" + json_number(live.confidence)
+		+ ",\"taps\":" + std::to_string(live.taps)
+		+ ",\"learning\":" + (live.timing ? "true" : "false") + "}";
+}
+
+/**
+ * @brief The REST service to get the beat lateness histogram, in microseconds
+*/
+void getLateness(const api_request& msg, api_response& res) {
+	const histogram& late = beats.lateness();
+	std::string body = "{\"count\":" + std::to_string(late.count())
+		+ ",\"missed\":" + std::to_string(beats.missed())
+		+ ",\"mean_us\":" + json_number(late.mean())
+		+ ",\"p50_us\":" + std::to_string(late.percentile(50))
+		+ ",\"p99_us\":" + std::to_string(late.percentile(99))
+		+ ",\"max_us\":" + std::to_string(late.max())
+		+ ",\"buckets\":[";
+	bool first = true;
+	for (const auto& bucket : late.buckets_used()) {
+		if (!first) {
+			body += ',';
+		}
+		first = false;
+		body += "{\"le_us\":" + std::to_string(bucket.first) + ",\"count\":" + std::to_string(bucket.second) + "}";
+	}
+	res.body = body + "]}";
 }
-void getMAX(web::http::http_request msg) {
-	msg_reply(msg, metro.getMinOrMax(MAX), 1);
+
+/**
+ * @brief The REST service to subscribe to the server-sent event stream, url is /bpm/stream
+ * Events are "beat", "tempo", "mode" and "tap"; a client reconnecting with
+ * Last-Event-ID resumes after that event if it is still buffered.
+*/
+void getStream(const api_request& msg, api_response& res) {
+	res.content_type = "text/event-stream";
+	res.stream = &events;
+	res.stream_from = events.head();
+	if (const std::string* last = msg.header("Last-Event-ID")) {
+		uint64_t next = std::strtoull(last->c_str(), nullptr, 10) + 1;
+		if (next <= res.stream_from && res.stream_from - next < event_stream::capacity) {
+			res.stream_from = next;
+		}
+	}
+	metronome::state s = metro.get_state();
+	// The current state first, so a new client does not wait for a change.
+	res.body = "retry: 1000\n\nevent: tempo\ndata: {\"bpm\":" + std::to_string(s.bpm)
+		+ ",\"min\":" + std::to_string(s.min)
+		+ ",\"max\":" + std::to_string(s.max)
+		+ ",\"size\":" + std::to_string(s.size)
+		+ ",\"version\":" + std::to_string(s.version) + "}\n\n";
 }
 
 // The REST service to delete the MIN and MAX BPM
-void deleteMIN(web::http::http_request msg) {
+void deleteMIN(const api_request& msg, api_response& res) {
 	bool isSuccess = metro.deleteMinOrMax(MIN);
 	updateBPM();
-	deleteBPMUtil(isSuccess, msg);
+	deleteBPMUtil(isSuccess, res);
 }
-void deleteMAX(web::http::http_request msg) {
+void deleteMAX(const api_request& msg, api_response& res) {
 	bool isSuccess = metro.deleteMinOrMax(MAX);
 	updateBPM();
-	deleteBPMUtil(isSuccess, msg);
+	deleteBPMUtil(isSuccess, res);
 }
 
 /**
  * @brief The REST service to set the BPM
  * @param msg the http request
 */
-void setBPM(web::http::http_request msg){
-	msg.extract_json().then([=](web::json::value req_body){
-		try{
-			auto bpmValue = req_body[U("bpm")].as_integer();
-            metro.addBPM(bpmValue);
-			updateBPM();
-            msg_reply(msg, 0, 0);
-		}catch(const std::exception& e){
-			// msg.reply(400, U("Bad Request"));
-			msg_wrong_reply(msg, "Bad Request", web::http::status_codes::BadRequest);
-			std::cerr << e.what() << std::endl;
-		}
-	}).wait();
+void setBPM(const api_request& msg, api_response& res){
+	try{
+		auto bpmValue = parse_bpm(msg);
+		metro.addBPM(bpmValue);
+		updateBPM();
+		msg_reply(res, 0, 0);
+	}catch(const std::exception& e){
+		// msg.reply(400, U("Bad Request"));
+		msg_wrong_reply(res, "Bad Request", 400);
+		std::cerr << e.what() << std::endl;
+	}
+}
+
+/**
+ * @brief The REST service to add many BPM values at once, url is /bpm/batch
+ * The body is a JSON array or NDJSON, all accepted values go into the
+ * history as one update and the blink period is updated once.
+ * @param msg the http request
+*/
+void setBPMbatch(const api_request& msg, api_response& res){
+	bpm_batch_parser batch;
+	batch.feed(msg.body.data(), msg.body.size());
+	if (!batch.finish()) {
+		msg_wrong_reply(res, "Bad Request, the body must be a JSON array or NDJSON", 400);
+		return;
+	}
+	if (batch.accepted() > 0) {
+		metro.addBPMs(batch.values());
+		updateBPM();
+	}
+	res.body = "{\"accepted\":" + std::to_string(batch.accepted())
+		+ ",\"rejected\":" + std::to_string(batch.rejected()) + "}";
 }
 
 /**
  * @brief The REST service to delete the BPM in the BPM list, url is /bpm/list
  * @param msg the http request
 */
-void deleteBPM(web::http::http_request msg){
-	msg.extract_json().then([=](web::json::value req_body){
-		try{
-			auto bpmValue = req_body[U("bpm")].as_integer();
-			bool isSuccess = metro.deleteBeatByValue(bpmValue);
-			updateBPM();
-			deleteBPMUtil(isSuccess, msg);
-		}catch(const std::exception& e){
-			msg_wrong_reply(msg, "Bad Request, please check the bpm value", web::http::status_codes::BadRequest);
-			std::cerr << e.what() << std::endl;
+void deleteBPM(const api_request& msg, api_response& res){
+	try{
+		auto bpmValue = parse_bpm(msg);
+		bool isSuccess = metro.deleteBeatByValue(bpmValue);
+		updateBPM();
+		deleteBPMUtil(isSuccess, res);
+	}catch(const std::exception& e){
+		msg_wrong_reply(res, "Bad Request, please check the bpm value", 400);
+		std::cerr << e.what() << std::endl;
+	}
+}
+
+request_stats& route_stats();
+
+/**
+ * @brief The REST service to get the per-route request latency, in microseconds
+*/
+void getRequestStats(const api_request& msg, api_response& res) {
+	request_stats& stats = route_stats();
+	std::string body = "{\"rejected\":" + std::to_string(stats.rejected_count())
+		+ ",\"timed_out\":" + std::to_string(stats.timed_out_count())
+		+ ",\"routes\":[";
+	for (size_t i = 0; i < stats.route_count(); i++) {
+		const histogram& latency = stats.latency(i);
+		if (i != 0) {
+			body += ',';
 		}
-	});
+		body += "{\"method\":" + json_string(stats.route(i).method)
+			+ ",\"path\":" + json_string(stats.route(i).path)
+			+ ",\"count\":" + std::to_string(latency.count())
+			+ ",\"p50_us\":" + std::to_string(latency.percentile(50))
+			+ ",\"p99_us\":" + std::to_string(latency.percentile(99))
+			+ ",\"p999_us\":" + std::to_string(latency.percentile(99.9))
+			+ ",\"max_us\":" + std::to_string(latency.max()) + "}";
+	}
+	res.body = body + "]}";
+}
+
+// The REST routes, served by either server engine.
+static const api_route routes[] = {
+	{ "GET",    "/bpm",          getBPM },
+	{ "PUT",    "/bpm",          setBPM },
+	{ "PUT",    "/bpm/batch",    setBPMbatch },
+	{ "GET",    "/bpm/min",      getMIN },
+	{ "DELETE", "/bpm/min",      deleteMIN },
+	{ "GET",    "/bpm/max",      getMAX },
+	{ "DELETE", "/bpm/max",      deleteMAX },
+	{ "GET",    "/bpm/list",     getBPMlist },
+	{ "DELETE", "/bpm/list",     deleteBPM },
+	{ "GET",    "/bpm/lateness", getLateness },
+	{ "GET",    "/bpm/live",     getLive },
+	{ "GET",    "/bpm/stream",   getStream },
+	{ "GET",    "/stats/latency", getRequestStats },
+};
+
+request_stats& route_stats() {
+	static request_stats stats(routes);
+	return stats;
 }
 
+int main(int argc, char** argv) {
+	daemon_config config;
+	if (!config.parse(argc, argv)) {
+		return 1;
+	}
 
-int main() {
 	// This setup method uses the Broadcom pin numbers. These are the
 	// larger numbers like 17, 24, etc, not the 0-16 virtual ones.
-	// we are using the pigpio library to control the GPIO pins.
-	if (gpioInitialise() < 0) {
-        std::cerr << "pigpio initialization failed." << std::endl;
+	// The GPIO backend is pigpio on the board, or the simulator off-device.
+	if (!gpio().initialise()) {
+        std::cerr << gpio().name() << " initialization failed." << std::endl;
         return 1;
     }
 
 	// Set up the directions of the pins.
 	// Be careful here, an input pin set as an output could burn out.
-	gpioSetMode(LED_RED, PI_OUTPUT);
-	gpioSetMode(LED_GREEN, PI_OUTPUT);
-    gpioSetMode(BTN_MODE, PI_INPUT);
-	gpioSetMode(BTN_TAP, PI_INPUT);
+	gpio().set_mode(LED_RED, GPIO_OUTPUT);
+	gpio().set_mode(LED_GREEN, GPIO_OUTPUT);
+    gpio().set_mode(BTN_MODE, GPIO_INPUT);
+	gpio().set_mode(BTN_TAP, GPIO_INPUT);
 	// Note that you can also set a pull-down here for the button,
 	// if you do not want to use the physical resistor.
 	// we are using the pull-up resistor.
-    gpioSetPullUpDown(BTN_MODE, PI_PUD_UP);
-	gpioSetPullUpDown(BTN_TAP, PI_PUD_UP);
-
-
+    gpio().set_pull(BTN_MODE, GPIO_PUD_UP);
+	gpio().set_pull(BTN_TAP, GPIO_PUD_UP);
 
 	// Configure the rest services after setting up the pins,
 	// but before we start using them.
-	auto getBPM_rest = rest::make_endpoint("/bpm");
-	auto getBPMLIST_rest = rest::make_endpoint("/bpm/list");
-	auto getMIN_rest = rest::make_endpoint("/bpm/min");
-	auto getMAX_rest = rest::make_endpoint("/bpm/max");
-
-	getBPM_rest.support(web::http::methods::GET, getBPM);
-	getBPM_rest.support(web::http::methods::PUT, setBPM);
-	getMIN_rest.support(web::http::methods::GET, getMIN);
-	getMIN_rest.support(web::http::methods::DEL, deleteMIN);
-	getMAX_rest.support(web::http::methods::GET, getMAX);
-	getMAX_rest.support(web::http::methods::DEL, deleteMAX);
-	getBPMLIST_rest.support(web::http::methods::GET, getBPMlist);
-	getBPMLIST_rest.support(web::http::methods::DEL, deleteBPM);
-
-	// Start the endpoints in sequence.
-
-	getBPM_rest.open().wait();
-	getMIN_rest.open().wait();
-	getMAX_rest.open().wait();
-	getBPMLIST_rest.open().wait();
-	//metronome metro;
+	// The built-in epoll server is the default, cpprest is the fallback.
+	std::vector<std::unique_ptr<http_listener>> listeners;
+	http_server::config server_config;
+	server_config.host = config.host;
+	server_config.port = config.port;
+	server_config.workers = config.workers;
+	server_config.max_in_flight = config.max_inflight;
+	server_config.request_timeout_ms = config.timeout_ms;
+	http_server server(routes, server_config, &route_stats());
+	if (config.engine == "cpprest") {
+		rest::limit(config.max_inflight, config.timeout_ms, &route_stats());
+		listeners = rest::open_routes(routes, config.host, config.port);
+	} else if (!server.start()) {
+		gpio().terminate();
+		return 1;
+	}
 
 	// Use a separate thread for the blinking.
 	// This way we do not have to worry about any delays
 	// caused by polling the button state / etc.
-	std::thread blink_thread(blink);
+	std::thread blink_thread(&beat_scheduler::run, &beats);
 	blink_thread.detach();
 
+	// Button edges are timestamped by backend alerts on its own thread,
+	// debounced, and handed to this thread as press events.
+	button_input input(gpio());
+	if (!input.watch(BTN_MODE, BTN_DEBOUNCE_US) || !input.watch(BTN_TAP, BTN_DEBOUNCE_US)) {
+		std::cerr << gpio().name() << " alert registration failed." << std::endl;
+		gpio().terminate();
+		return 1;
+	}
 
-	//initial the blink frequency to 1000ms
-	blink_gap_time = 1000;
-	
-
-	// ** This loop manages reading button state. **
+	// ** This loop manages button presses. **
 	while (true) {
-		// We are using a pull-down, so pressed = HIGH.
-		// If you used a pull-up, compare with LOW instead.
-		//btn_mode_pressed = (digitalRead(BTN_MODE) == HIGH);
-		
+		button_input::event ev = input.wait_event();
+
 		//Learn Mode
-		if(gpioRead(BTN_MODE) == PI_LOW){
+		if(ev.pin == BTN_MODE){
 			std::cout << "Mode button pressed, now in learn mode" << std::endl;			
 			if(!metro.is_timing())
 				metro.start_timing();
@@ -287,23 +519,19 @@ int main() {
 				metro.stop_timing();
 				updateBPM();
 			}
-			std::this_thread::sleep_for(std::chrono::milliseconds(200));
+			publish_tap("mode", ev.time_us);
 		}
 
-		if(metro.is_timing()){
-			if(gpioRead(BTN_TAP) == PI_LOW){
-				// the tap button is pressed
-				std::cout << "Tap button pressed" << std::endl;
-				metro.tap();
-				//blink the red led when the tap button is pressed
-				blink_led_when_tap();
-				std::this_thread::sleep_for(std::chrono::milliseconds(200));
-			}
+		if(ev.pin == BTN_TAP && metro.is_timing()){
+			// the tap button is pressed
+			std::cout << "Tap button pressed" << std::endl;
+			metro.tap(ev.time_us);
+			publish_tap("tap", ev.time_us);
+			//blink the red led when the tap button is pressed
+			blink_led_when_tap();
 		}
-		
-		std::this_thread::sleep_for(10ms);
 	}
 	// Clean up the GPIO pins.
-	gpioTerminate();
+	gpio().terminate();
 	return 0;
 }
\ No newline at end of file
@@ -1,143 +1,164 @@
 #pragma once
 
+#include <atomic>
 #include <cstddef>
+#include <cstdint>
 #include <chrono>
+#include <iostream>
+#include <mutex>
+#include <vector>
 #include <stdio.h>
+
+#include "bpm_history.hpp"
+#include "seqlock.hpp"
+#include "tempo_estimator.hpp"
 #define MIN 0
 class metronome
 {
 public:
-	//store 4 sample beats
+	//store 4 sample beats unless a larger history is asked for
 	enum { beat_samples = 4 };
 
+	/**
+	 * @brief Summary of the BPM history published to readers.
+	 * version increases on every change of the history.
+	*/
+	struct state {
+		size_t bpm;
+		size_t min;
+		size_t max;
+		size_t size;
+		uint64_t version;
+	};
+
+	/**
+	 * @brief The live tempo estimate while in learn mode
+	*/
+	struct live_tempo {
+		double bpm;
+		double confidence;
+		size_t taps;
+		bool timing;
+	};
+
 public:
-	metronome()
-	: m_timing(false), m_beat_count(0) {
-		// initial the beat samples all to 0
-		for(int i = 0; i < beat_samples ; i++){
-			m_beats[i] = 0;
-		}
+	explicit metronome(size_t history_size = beat_samples)
+	: m_timing(false), m_beats(history_size), m_beat_count(0), m_version(0) {
+		publish();
+		publish_live();
 	}
 	~metronome() {}
 
 public:
 	// Call when entering "learn" mode
 	void start_timing(){
+		std::lock_guard<std::mutex> lock(m_write_mutex);
 		std::cout << "Begin timing"<< std::endl;
-		m_timing = true;
-		//reset the first and last tap time
-		first_tap_time = last_tap_time = 0;
+		//reset the tap timestamps
+		m_estimator.reset();
 		m_beat_count = 0;
+		m_timing = true;
+		publish_live();
 	}
 	// Call when leaving "learn" mode
 	void stop_timing(){
+		std::lock_guard<std::mutex> lock(m_write_mutex);
 		std::cout << "Stop timing"<< std::endl;
 		std::cout << "Mode button pressed, now in play mode" << std::endl;
 		m_timing = false;
+		tempo_estimator::estimate est = m_estimator.get();
 		//at least 4 taps to get new BPM measurment
-		if(m_beat_count >= 4) {
-			//replace the new BPM with the oldest one
-			for(int i = 0 ; i < beat_samples-1 ; i++) {
-				m_beats[i] = m_beats[i+1];
-			}			
-			//calculate seconds between the first and last tap
-			double seconds = ((double)(last_tap_time - first_tap_time) / (double) 1000);
-			if(seconds <= 0){
-				// if the time is less than 0, then the BPM is 0
-				std::cerr << "Something is wrong with the time calculation"<< last_tap_time << first_tap_time << seconds << std::endl;
-				m_beats[beat_samples-1] = 0;
+		if(est.taps >= 4) {
+			if(est.bpm < 0.5){
+				// if the taps do not give a period, keep the history as it is
+				std::cerr << "Something is wrong with the time calculation" << std::endl;
 			} else{
-				// calculate the BPM with minutes
-				m_beats[beat_samples-1] = size_t ((double) m_beat_count * ((double) 60 / seconds));
+				// the fitted beat period over all taps, rounded to whole BPM,
+				// replaces the oldest measurement when the history is full
+				m_beats.add(size_t (est.bpm + 0.5));
+				std::cout << "New BPM calculated: "<< m_beats.latest()
+					<< " confidence " << est.confidence << std::endl;
+				publish();
 			}
-			std::cout << "New BPM calculated: "<< m_beats[beat_samples-1] << std::endl;
 		} else {
 			std::cerr << "At least four taps for new a BPM measurment" << std::endl;
 		}
+		publish_live();
 	}
 
-	/**
-	 * @brief Get the current time in milliseconds
-	*/
-	size_t currentMillis() {
-		auto now = std::chrono::system_clock::now();
-		auto now_ms = std::chrono::time_point_cast<std::chrono::milliseconds>(now);
-		auto epoch = now_ms.time_since_epoch();
-		auto value = std::chrono::duration_cast<std::chrono::milliseconds>(epoch);
-		return static_cast<size_t>(value.count());
-	}
-
-	// Should only record the current time when timing
-	// Insert the time at the next free position of m_beats
-	void tap(){
-		size_t time_stamp = currentMillis();
-		if(first_tap_time == 0){
-			//first tap to start the timing
-			first_tap_time = time_stamp;
+	// Should only record the tap time when timing
+	// time_stamp is the microsecond timestamp of the button edge
+	void tap(uint64_t time_stamp){
+		std::lock_guard<std::mutex> lock(m_write_mutex);
+		if(!m_estimator.add_tap(time_stamp)){
+			std::cout<< "tap rejected as an outlier" << std::endl;
+			return;
 		}
-		last_tap_time = time_stamp;
 		m_beat_count++;
+		publish_live();
 		std::cout<< "beat count: " << m_beat_count << std::endl;
-		std::cout<< "m_beats list=[ ";
-		for(int i = 0 ; i < beat_samples ; i++){
-			std::cout<< m_beats[i] << ", ";
-		}
-		std::cout<<"]"<<std::endl;
-		
+		std::cout<< "history size: " << m_beats.size() << std::endl;
+
 	}
 
-	bool is_timing() const { return m_timing; }
-	// Calculate the BPM from the deltas between m_beats
-	// Return 0 if there are not enough samples
+	bool is_timing() const { return m_timing.load(std::memory_order_acquire); }
+
+	/**
+	 * @brief Get a consistent copy of the published history, never blocks
+	*/
+	state get_state() const { return m_state.load(); }
+
+	/**
+	 * @brief The state version, bumped by every change of the history
+	*/
+	uint64_t version() const { return m_state.load().version; }
+
+	/**
+	 * @brief Get the live tempo of the taps so far, updated on every tap
+	*/
+	live_tempo get_live() const { return m_live.load(); }
+
+	// The latest BPM measurement
+	// Return 0 if there are no measurements
 	size_t get_bpm() const {
 		//get the latest BPM record
-		std::cout<<"Current bpm = "<< m_beats[beat_samples-1] << std::endl;
-		return m_beats[beat_samples-1];
-		
+		size_t bpm = m_state.load().bpm;
+		std::cout<<"Current bpm = "<< bpm << std::endl;
+		return bpm;
+
 	}
 	/**
-	 * @brief Get the BPM list
+	 * @brief Get the BPM list, oldest first, without deleted values.
+	 * This copies the whole history under the writer lock.
+	 * @param version if set, receives the state version of the list
 	*/
-	std::vector<size_t> get_bpm_list() const {
-		std::vector<size_t> bpm_list;
-		for(int i = 0 ; i < beat_samples ; i++){
-			bpm_list.push_back(m_beats[i]);
+	std::vector<size_t> get_bpm_list(uint64_t* version = nullptr) const {
+		std::lock_guard<std::mutex> lock(m_write_mutex);
+		if (version != nullptr) {
+			*version = m_version;
 		}
-		return bpm_list;
+		return m_beats.values();
 	}
 
 	/**
  	 * @brief Get the MIN or MAX BPM
-	 * @param mode 0 for get MIN, mode 1 for get MAX 
+	 * @param mode 0 for get MIN, mode 1 for get MAX
 	*/
 	size_t getMinOrMax(int mode) const {
-		size_t res = m_beats[0];
+		state s = m_state.load();
 		//mode 0 for get MIN, mode 1 for get MAX
-		if (mode == MIN) {
-			for(int i = 1 ; i < beat_samples ; i++){
-				if(m_beats[i] < res) {
-					res = m_beats[i];
-				}
-			}
-			return res;
-		} else {
-			for(int i = 1 ; i < beat_samples ; i++){
-				if(m_beats[i] > res) {
-					res = m_beats[i];
-				}
-			}
-			return res;
-		}
-		return 0;
+		return (mode == MIN) ? s.min : s.max;
 	}
 
 	/**
 	 * @brief Delete the MIN or MAX BPM, return true if the BPM is deleted successfully
-	 * @param mode 0 for delete MIN, mode 1 for delete MAX 
+	 * @param mode 0 for delete MIN, mode 1 for delete MAX
 	*/
 	bool deleteMinOrMax(int mode) {
-		size_t value = getMinOrMax(mode);
-		bool isSuccess = deleteBeatByValue(value);
+		std::lock_guard<std::mutex> lock(m_write_mutex);
+		// Pick the value under the writer lock so a concurrent change can not move it.
+		size_t value = (mode == MIN) ? m_beats.min() : m_beats.max();
+		bool isSuccess = deleteBeatByValueLocked(value);
 		return isSuccess;
 	}
 
@@ -145,37 +166,82 @@ public:
 	 * @brief Add the new BPM value to the BPM list
 	*/
 	void addBPM(size_t new_bpm) {
-		//replace the new BPM with the oldest one
-		for(int i = 0 ; i < beat_samples-1 ; i++) {
-			m_beats[i] = m_beats[i+1];
+		std::lock_guard<std::mutex> lock(m_write_mutex);
+		//replace the oldest BPM when the history is full
+		m_beats.add(new_bpm);
+		publish();
+	}
+
+	/**
+	 * @brief Add a batch of BPM values as one change of the history.
+	 * Readers see either none or all of them, and the version moves once.
+	*/
+	void addBPMs(const std::vector<size_t>& values) {
+		if (values.empty()) {
+			return;
+		}
+		std::lock_guard<std::mutex> lock(m_write_mutex);
+		for (size_t bpm : values) {
+			m_beats.add(bpm);
 		}
-		m_beats[beat_samples-1] = new_bpm;
+		publish();
 	}
 
     /**
-	 * @brief Delete the BPM value from the BPM list
+	 * @brief Delete the oldest occurrence of the BPM value from the BPM list
 	*/
 	bool deleteBeatByValue(size_t value) {
+		std::lock_guard<std::mutex> lock(m_write_mutex);
+		return deleteBeatByValueLocked(value);
+	}
+
+
+private:
+	bool deleteBeatByValueLocked(size_t value) {
+		if (m_beats.remove(value)) {
+			std::cout << "BPM value "<< value << " deleted" << std::endl;
+			publish();
+			return true;
+		}
 		if (value == 0) {
+			// Nothing to delete, an empty history has min and max 0.
 			return true;
 		}
-        for (size_t i = 0; i < beat_samples; ++i) {
-            if (m_beats[i] == value) {
-                m_beats[i] = 0;
-				std::cout << "BPM value "<< value << " deleted" << std::endl;
-				return true;
-            }
-        }
 		std::cerr << "BPM value not found" << std::endl;
 		return false;
-    }
-	
+	}
+
+	// Publish the history to readers, called with m_write_mutex held.
+	void publish() {
+		state s;
+		s.bpm = m_beats.latest();
+		s.min = m_beats.min();
+		s.max = m_beats.max();
+		s.size = m_beats.size();
+		s.version = ++m_version;
+		m_state.store(s);
+	}
+
+	// Publish the live tempo estimate, called with m_write_mutex held.
+	void publish_live() {
+		tempo_estimator::estimate est = m_estimator.get();
+		live_tempo live;
+		live.bpm = est.bpm;
+		live.confidence = est.confidence;
+		live.taps = est.taps;
+		live.timing = m_timing;
+		m_live.store(live);
+	}
 
 private:
-	bool m_timing;
-	size_t first_tap_time;
-	size_t last_tap_time;
-	// Insert new samples at the end of the array, removing the oldest
-	size_t m_beats[beat_samples];
+	std::atomic<bool> m_timing;
+	// Serializes writers; readers only touch m_state.
+	mutable std::mutex m_write_mutex;
+	tempo_estimator m_estimator;
+	// Insert new samples at the end of the ring, removing the oldest
+	bpm_history m_beats;
 	size_t m_beat_count;
-};
\ No newline at end of file
+	uint64_t m_version;
+	seqlock<state> m_state;
+	seqlock<live_tempo> m_live;
+};
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+#include "api.hpp"
+#include "histogram.hpp"
+
+/**
+ * @brief Per-route request counts and latency histograms, in microseconds.
+ * Latency runs from the complete request to the filled in response,
+ * including the time a mutation waits for an executor slot.
+*/
+class request_stats
+{
+public:
+	template <size_t N>
+	explicit request_stats(const api_route (&routes)[N])
+	: m_routes(routes), m_route_count(N), m_latency(new histogram[N]),
+	  m_rejected(0), m_timed_out(0) {}
+
+	size_t route_count() const { return m_route_count; }
+	const api_route& route(size_t i) const { return m_routes[i]; }
+	const histogram& latency(size_t i) const { return m_latency[i]; }
+
+	void record(size_t route, uint64_t latency_us) {
+		if (route < m_route_count) {
+			m_latency[route].record(latency_us);
+		}
+	}
+
+	// Requests refused with 503 because too many were in flight.
+	void rejected() { m_rejected.fetch_add(1, std::memory_order_relaxed); }
+	// Requests answered 408 or 503 because they ran out of time.
+	void timed_out() { m_timed_out.fetch_add(1, std::memory_order_relaxed); }
+	uint64_t rejected_count() const { return m_rejected.load(std::memory_order_relaxed); }
+	uint64_t timed_out_count() const { return m_timed_out.load(std::memory_order_relaxed); }
+
+	/**
+	 * @brief Index of the route of a method and path, route_count() if none
+	*/
+	size_t find(const std::string& method, const std::string& path) const {
+		for (size_t i = 0; i < m_route_count; i++) {
+			if (path == m_routes[i].path && method == m_routes[i].method) {
+				return i;
+			}
+		}
+		return m_route_count;
+	}
+
+private:
+	const api_route* m_routes;
+	size_t m_route_count;
+	std::unique_ptr<histogram[]> m_latency;
+	std::atomic<uint64_t> m_rejected;
+	std::atomic<uint64_t> m_timed_out;
+};
+
+/**
+ * @brief Counting gate that bounds the number of requests in flight
+*/
+class request_gate
+{
+public:
+	explicit request_gate(int limit) : m_limit(limit), m_in_flight(0) {}
+
+	bool try_acquire() {
+		int n = m_in_flight.fetch_add(1, std::memory_order_acquire);
+		if (n >= m_limit) {
+			m_in_flight.fetch_sub(1, std::memory_order_release);
+			return false;
+		}
+		return true;
+	}
+	void release() { m_in_flight.fetch_sub(1, std::memory_order_release); }
+	int in_flight() const { return m_in_flight.load(std::memory_order_relaxed); }
+
+private:
+	int m_limit;
+	std::atomic<int> m_in_flight;
+};
+
+/**
+ * @brief True for methods that change state and run on the bounded pipeline
+*/
+inline bool is_mutation(const std::string& method) {
+	return method != "GET" && method != "OPTIONS" && method != "HEAD";
+}
+
+/**
+ * @brief Fill in the 503 answer of a full pipeline
+*/
+inline void busy_reply(api_response& res) {
+	res = api_response();
+	res.status = 503;
+	res.body = "{\"msg\":\"Service Unavailable, too many requests in flight\"}";
+	res.headers.push_back(std::make_pair("Retry-After", "1"));
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+
+/**
+ * @brief Cache of one endpoint's serialized response body.
+ * The body is tagged with the metronome state version it was built from,
+ * and rebuilt only when a request sees a newer version. Readers share the
+ * cached entry through an atomically swapped shared_ptr.
+*/
+class response_cache
+{
+public:
+	struct entry {
+		uint64_t version;
+		std::string etag;
+		std::string body;
+	};
+
+public:
+	/**
+	 * @brief The ETag of a state version, unique across restarts
+	*/
+	static std::string etag_of(uint64_t version) {
+		return "\"" + std::to_string(boot_id()) + "-" + std::to_string(version) + "\"";
+	}
+
+	/**
+	 * @brief Check an If-None-Match header value against an ETag
+	*/
+	static bool matches(const std::string& if_none_match, const std::string& etag) {
+		if (if_none_match == "*") {
+			return true;
+		}
+		// The header may list several tags, possibly weak ones.
+		size_t pos = if_none_match.find(etag);
+		return pos != std::string::npos;
+	}
+
+	/**
+	 * @brief Get the body for the current version, building it if the cache is stale
+	 * @param version the current state version
+	 * @param build returns the (version, body) pair of a fresh serialization
+	*/
+	template <typename F>
+	std::shared_ptr<const entry> get(uint64_t version, F build) {
+		std::shared_ptr<const entry> cached = std::atomic_load(&m_entry);
+		if (cached && cached->version >= version) {
+			return cached;
+		}
+		std::pair<uint64_t, std::string> fresh = build();
+		std::shared_ptr<const entry> built(new entry{ fresh.first, etag_of(fresh.first), std::move(fresh.second) });
+		// Another request may have stored a newer one meanwhile, keep the newest.
+		while (!cached || cached->version < built->version) {
+			if (std::atomic_compare_exchange_weak(&m_entry, &cached, built)) {
+				break;
+			}
+		}
+		return built;
+	}
+
+private:
+	static uint64_t boot_id() {
+		static const uint64_t id = (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+			std::chrono::system_clock::now().time_since_epoch()).count();
+		return id;
+	}
+
+private:
+	std::shared_ptr<const entry> m_entry;
+};
@@ -1,34 +1,182 @@
-#include <string>
-
-#include <cpprest/http_listener.h>
-
-using http_listener = web::http::experimental::listener::http_listener;
-
-class rest {
-public:
-        static http_listener make_endpoint(const std::string& path) {
-                web::uri_builder builder;
-                builder.set_scheme("http");
-                builder.set_host("0.0.0.0");
-                builder.set_port(8080);
-                builder.set_path(path);
-
-                auto listener = http_listener(builder.to_uri());
-                listener.support(web::http::methods::OPTIONS, allowAll);
-
-                return listener;
-        }
-
-private:
-        static void allowAll(web::http::http_request msg) {
-                web::http::http_response response(200);
-                response.headers().add("Access-Control-Allow-Origin", "*");
-                response.headers().add("Access-Control-Allow-Methods", "GET, PUT, DELETE");
-                response.headers().add("Access-Control-Allow-Headers", "Content-Type");
-
-                msg.reply(response);
-        }
-
-private:
-        rest();
-};
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <cpprest/http_listener.h>
+
+#include "api.hpp"
+#include "request_stats.hpp"
+
+using http_listener = web::http::experimental::listener::http_listener;
+
+class rest {
+public:
+        static http_listener make_endpoint(const std::string& path, const std::string& host = "0.0.0.0", int port = 8080,
+                        const web::http::experimental::listener::http_listener_config& config = web::http::experimental::listener::http_listener_config()) {
+                web::uri_builder builder;
+                builder.set_scheme("http");
+                builder.set_host(host);
+                builder.set_port(port);
+                builder.set_path(path);
+
+                auto listener = http_listener(builder.to_uri(), config);
+                listener.support(web::http::methods::OPTIONS, allowAll);
+
+                return listener;
+        }
+
+        /**
+         * @brief Open one cpprest listener per path of the route table
+         * @return the open listeners, which must be kept alive
+        */
+        /**
+         * @brief Bound the mutations in flight and their time to complete
+         * @param max_in_flight mutations allowed at once, more get 503
+         * @param timeout_ms a request older than this when its body is read gets 408
+         * @param stats where to record latency, rejections and timeouts, may be nullptr
+        */
+        static void limit(int max_in_flight, int timeout_ms, request_stats* stats) {
+                settings().gate.reset(new request_gate(max_in_flight));
+                settings().timeout_ms = timeout_ms;
+                settings().stats = stats;
+        }
+
+        template <size_t N>
+        static std::vector<std::unique_ptr<http_listener>> open_routes(const api_route (&routes)[N], const std::string& host, int port) {
+                std::vector<std::unique_ptr<http_listener>> listeners;
+                std::vector<std::string> paths;
+                for (size_t i = 0; i < N; i++) {
+                        size_t j = 0;
+                        while (j < paths.size() && paths[j] != routes[i].path) j++;
+                        if (j == paths.size()) {
+                                paths.push_back(routes[i].path);
+                                web::http::experimental::listener::http_listener_config config;
+                                config.set_timeout(std::chrono::milliseconds(settings().timeout_ms));
+                                listeners.emplace_back(new http_listener(make_endpoint(routes[i].path, host, port, config)));
+                        }
+                        serve(*listeners[j], routes[i].method, routes[i].handler);
+                }
+                // Start the endpoints in sequence.
+                for (auto& listener : listeners) {
+                        listener->open().wait();
+                }
+                return listeners;
+        }
+
+        /**
+         * @brief Bind an engine independent handler to a cpprest listener
+        */
+        static void serve(http_listener& listener, const web::http::method& method, api_handler handler) {
+                listener.support(method, [handler](web::http::http_request msg) {
+                        auto arrived = std::chrono::steady_clock::now();
+                        if (msg.method() == web::http::methods::GET) {
+                                call(msg, handler, std::string(), arrived);
+                                return;
+                        }
+                        // Mutations are bounded, the client is told to retry later.
+                        request_gate* gate = settings().gate.get();
+                        if (gate != nullptr && !gate->try_acquire()) {
+                                api_response res;
+                                busy_reply(res);
+                                if (settings().stats) settings().stats->rejected();
+                                reply(msg, res);
+                                return;
+                        }
+                        // Read the body as a continuation instead of blocking the worker.
+                        msg.extract_utf8string().then([msg, handler, gate, arrived](pplx::task<std::string> body) {
+                                std::string text;
+                                api_response res;
+                                try {
+                                        text = body.get();
+                                } catch (const std::exception& e) {
+                                        res.status = 400;
+                                        res.body = "{\"msg\":\"Bad Request\"}";
+                                }
+                                if (res.status == 200 && std::chrono::steady_clock::now() - arrived > std::chrono::milliseconds(settings().timeout_ms)) {
+                                        res.status = 408;
+                                        res.body = "{\"msg\":\"Request Timeout\"}";
+                                        if (settings().stats) settings().stats->timed_out();
+                                }
+                                if (res.status == 200) {
+                                        call(msg, handler, text, arrived);
+                                } else {
+                                        reply(msg, res);
+                                }
+                                if (gate != nullptr) gate->release();
+                        });
+                });
+        }
+
+        /**
+         * @brief Send an engine independent response through cpprest
+        */
+        static void reply(web::http::http_request msg, const api_response& res) {
+                if (res.stream != nullptr) {
+                        // Event streams are only served by the epoll engine.
+                        api_response unsupported;
+                        unsupported.status = 501;
+                        unsupported.body = "{\"msg\":\"Not Implemented, use --engine=epoll for event streams\"}";
+                        reply(msg, unsupported);
+                        return;
+                }
+                web::http::http_response response(res.status);
+                response.headers().add(U("Access-Control-Allow-Origin"), U("*"));
+                for (const auto& h : res.headers) {
+                        response.headers().add(h.first, h.second);
+                }
+                if (res.status != 304 && res.status != 204) {
+                        response.set_body(res.body, res.content_type);
+                }
+                msg.reply(response);
+        }
+
+private:
+        struct limits {
+                std::unique_ptr<request_gate> gate;
+                int timeout_ms = 10000;
+                request_stats* stats = nullptr;
+        };
+
+        static limits& settings() {
+                static limits l;
+                return l;
+        }
+
+        static void call(web::http::http_request msg, api_handler handler, const std::string& body,
+                        std::chrono::steady_clock::time_point arrived) {
+                api_request req;
+                req.method = msg.method();
+                req.path = msg.request_uri().path();
+                req.query = msg.request_uri().query();
+                req.body = body;
+                for (const auto& h : msg.headers()) {
+                        req.headers.push_back(std::make_pair(h.first, h.second));
+                }
+                api_response res;
+                try {
+                        handler(req, res);
+                } catch (const std::exception& e) {
+                        res = api_response();
+                        res.status = 500;
+                        res.body = "{\"msg\":\"Internal Server Error\"}";
+                }
+                if (request_stats* stats = settings().stats) {
+                        stats->record(stats->find(req.method, req.path), (uint64_t) std::chrono::duration_cast<std::chrono::microseconds>(
+                                std::chrono::steady_clock::now() - arrived).count());
+                }
+                reply(msg, res);
+        }
+
+        static void allowAll(web::http::http_request msg) {
+                web::http::http_response response(200);
+                response.headers().add("Access-Control-Allow-Origin", "*");
+                response.headers().add("Access-Control-Allow-Methods", "GET, PUT, DELETE");
+                response.headers().add("Access-Control-Allow-Headers", "Content-Type");
+
+                msg.reply(response);
+        }
+
+private:
+        rest();
+};
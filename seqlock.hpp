@@ -0,0 +1,65 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+/**
+ * @brief Single-writer sequence lock around a trivially copyable value.
+ * Readers never block or write shared memory, they retry if a write
+ * overlapped their copy. Writers must be serialized by the caller.
+*/
+template <typename T>
+class seqlock
+{
+	static_assert(std::is_trivially_copyable<T>::value, "seqlock needs a trivially copyable type");
+
+	enum { words = (sizeof(T) + sizeof(uint64_t) - 1) / sizeof(uint64_t) };
+
+public:
+	seqlock() : m_seq(0) {
+		for (size_t i = 0; i < words; i++) {
+			m_data[i].store(0, std::memory_order_relaxed);
+		}
+	}
+	explicit seqlock(const T& value) : seqlock() { store(value); }
+
+	/**
+	 * @brief Read a consistent copy of the value
+	*/
+	T load() const {
+		uint64_t buf[words];
+		uint32_t before, after;
+		do {
+			before = m_seq.load(std::memory_order_acquire);
+			for (size_t i = 0; i < words; i++) {
+				buf[i] = m_data[i].load(std::memory_order_relaxed);
+			}
+			std::atomic_thread_fence(std::memory_order_acquire);
+			after = m_seq.load(std::memory_order_relaxed);
+		} while ((before & 1) || before != after);
+		T value;
+		std::memcpy(&value, buf, sizeof(T));
+		return value;
+	}
+
+	/**
+	 * @brief Publish a new value, callers must hold their writer lock
+	*/
+	void store(const T& value) {
+		uint64_t buf[words] = {};
+		std::memcpy(buf, &value, sizeof(T));
+		uint32_t seq = m_seq.load(std::memory_order_relaxed);
+		m_seq.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		for (size_t i = 0; i < words; i++) {
+			m_data[i].store(buf[i], std::memory_order_relaxed);
+		}
+		m_seq.store(seq + 2, std::memory_order_release);
+	}
+
+private:
+	std::atomic<uint32_t> m_seq;
+	std::atomic<uint64_t> m_data[words];
+};
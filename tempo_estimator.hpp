@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+/**
+ * @brief Streaming tempo estimate over tap timestamps.
+ * The last taps are kept in a ring, each tagged with its beat index, and a
+ * least-squares line of time against beat index gives the beat period.
+ * The fit sums are updated in O(1) per tap. Taps that come much too early
+ * (double presses, bounce) are rejected, and a tap after a gap of several
+ * periods counts the missed beats instead of stretching the tempo.
+*/
+class tempo_estimator
+{
+public:
+	enum { window = 32 };
+	// Longest gap, in beats, still treated as missed taps rather than a pause.
+	enum { max_skipped_beats = 4 };
+
+	struct estimate {
+		double bpm;
+		double confidence; // 0 for no idea, up to 1 for steady taps
+		size_t taps;       // accepted taps in the current session
+		size_t rejected;   // taps rejected as outliers
+	};
+
+public:
+	tempo_estimator() { reset(); }
+
+	void reset() {
+		m_count = 0;
+		m_head = 0;
+		m_taps = 0;
+		m_rejected = 0;
+		m_origin = 0;
+		m_last_time = 0;
+		m_last_index = 0;
+		m_sx = m_sy = m_sxx = m_sxy = m_syy = 0;
+	}
+
+	/**
+	 * @brief Add one tap, return false if it was rejected as an outlier
+	 * @param time_us the tap timestamp in microseconds
+	*/
+	bool add_tap(uint64_t time_us) {
+		if (m_taps == 0) {
+			m_origin = time_us;
+			push(0, time_us);
+			return true;
+		}
+		if (time_us <= m_last_time) {
+			m_rejected++;
+			return false;
+		}
+		double ioi = (double) (time_us - m_last_time) / 1e6;
+		double period = current_period();
+		uint64_t steps = 1;
+		if (period > 0) {
+			if (ioi < 0.5 * period) {
+				// Too early to be the next beat.
+				m_rejected++;
+				return false;
+			}
+			double beats = std::floor(ioi / period + 0.5);
+			if (beats > max_skipped_beats) {
+				// A pause, start a new session from this tap.
+				reset();
+				m_origin = time_us;
+				push(0, time_us);
+				return true;
+			}
+			steps = (uint64_t) beats;
+		}
+		push(m_last_index + steps, time_us);
+		return true;
+	}
+
+	estimate get() const {
+		estimate e;
+		e.taps = m_taps;
+		e.rejected = m_rejected;
+		e.bpm = 0;
+		e.confidence = 0;
+		double period = current_period();
+		if (period <= 0) {
+			return e;
+		}
+		e.bpm = 60.0 / period;
+		if (m_count >= 3) {
+			// Residual spread of the taps around the fitted line.
+			double n = (double) m_count;
+			double syy = m_syy - m_sy * m_sy / n;
+			double sxy = m_sxy - m_sx * m_sy / n;
+			double sse = syy - period * sxy;
+			double sigma = std::sqrt(sse > 0 ? sse / (n - 2) : 0);
+			double spread = 1.0 - std::fmin(1.0, 5.0 * sigma / period);
+			double support = std::fmin(1.0, (n - 1) / 8.0);
+			e.confidence = spread * support;
+		}
+		return e;
+	}
+
+private:
+	// Seconds per beat from the fit, 0 with fewer than two taps.
+	double current_period() const {
+		if (m_count < 2) {
+			return 0;
+		}
+		double n = (double) m_count;
+		double den = n * m_sxx - m_sx * m_sx;
+		if (den <= 0) {
+			return 0;
+		}
+		return (n * m_sxy - m_sx * m_sy) / den;
+	}
+
+	void push(uint64_t index, uint64_t time_us) {
+		double x = (double) index;
+		double y = (double) (time_us - m_origin) / 1e6;
+		if (m_count == window) {
+			// Evict the oldest tap from the fit.
+			const point& old = m_points[m_head];
+			m_sx -= old.x; m_sy -= old.y;
+			m_sxx -= old.x * old.x; m_sxy -= old.x * old.y; m_syy -= old.y * old.y;
+		} else {
+			m_count++;
+		}
+		m_points[m_head] = point{ x, y };
+		m_head = (m_head + 1) % window;
+		m_sx += x; m_sy += y;
+		m_sxx += x * x; m_sxy += x * y; m_syy += y * y;
+		m_last_index = index;
+		m_last_time = time_us;
+		m_taps++;
+	}
+
+private:
+	struct point {
+		double x; // beat index
+		double y; // seconds since the session origin
+	};
+
+	point m_points[window];
+	size_t m_count;
+	size_t m_head;
+	size_t m_taps;
+	size_t m_rejected;
+	uint64_t m_origin;
+	uint64_t m_last_time;
+	uint64_t m_last_index;
+	double m_sx, m_sy, m_sxx, m_sxy, m_syy;
+};